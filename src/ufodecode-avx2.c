@@ -0,0 +1,527 @@
+#include <string.h>
+#include <immintrin.h>
+#include "config.h"
+#include "ufodecode-private.h"
+
+/*
+ * Eight payload blocks are exactly eight 256-bit registers. After transposing
+ * them, each register holds the same word of all eight blocks, so one lane
+ * corresponds to one block. Because consecutive blocks carry consecutive pixel
+ * numbers, the eight lanes of one channel end up as eight adjacent pixels and
+ * can be written with a single 128-bit store.
+ */
+
+#define NUM_BLOCKS  8
+
+static inline void
+transpose_8x8 (__m256i r[8])
+{
+    const __m256i t0 = _mm256_unpacklo_epi32 (r[0], r[1]);
+    const __m256i t1 = _mm256_unpackhi_epi32 (r[0], r[1]);
+    const __m256i t2 = _mm256_unpacklo_epi32 (r[2], r[3]);
+    const __m256i t3 = _mm256_unpackhi_epi32 (r[2], r[3]);
+    const __m256i t4 = _mm256_unpacklo_epi32 (r[4], r[5]);
+    const __m256i t5 = _mm256_unpackhi_epi32 (r[4], r[5]);
+    const __m256i t6 = _mm256_unpacklo_epi32 (r[6], r[7]);
+    const __m256i t7 = _mm256_unpackhi_epi32 (r[6], r[7]);
+
+    const __m256i u0 = _mm256_unpacklo_epi64 (t0, t2);
+    const __m256i u1 = _mm256_unpackhi_epi64 (t0, t2);
+    const __m256i u2 = _mm256_unpacklo_epi64 (t1, t3);
+    const __m256i u3 = _mm256_unpackhi_epi64 (t1, t3);
+    const __m256i u4 = _mm256_unpacklo_epi64 (t4, t6);
+    const __m256i u5 = _mm256_unpackhi_epi64 (t4, t6);
+    const __m256i u6 = _mm256_unpacklo_epi64 (t5, t7);
+    const __m256i u7 = _mm256_unpackhi_epi64 (t5, t7);
+
+    r[0] = _mm256_permute2x128_si256 (u0, u4, 0x20);
+    r[1] = _mm256_permute2x128_si256 (u1, u5, 0x20);
+    r[2] = _mm256_permute2x128_si256 (u2, u6, 0x20);
+    r[3] = _mm256_permute2x128_si256 (u3, u7, 0x20);
+    r[4] = _mm256_permute2x128_si256 (u0, u4, 0x31);
+    r[5] = _mm256_permute2x128_si256 (u1, u5, 0x31);
+    r[6] = _mm256_permute2x128_si256 (u2, u6, 0x31);
+    r[7] = _mm256_permute2x128_si256 (u3, u7, 0x31);
+}
+
+/* Store one channel of eight consecutive blocks from a and another one from b */
+static inline void
+store_two (uint16_t *dst_a, uint16_t *dst_b, __m256i a, __m256i b)
+{
+    const __m256i packed = _mm256_permute4x64_epi64 (_mm256_packus_epi32 (a, b), _MM_SHUFFLE (3, 1, 2, 0));
+
+    _mm_storeu_si128 ((__m128i *) dst_a, _mm256_castsi256_si128 (packed));
+    _mm_storeu_si128 ((__m128i *) dst_b, _mm256_extracti128_si256 (packed, 1));
+}
+
+/* Store channels c and c + 1 of eight consecutive blocks */
+static inline void
+store_pair (uint16_t *dst, __m256i a, __m256i b)
+{
+    store_two (dst, dst + IPECAMERA_PIXELS_PER_CHANNEL, a, b);
+}
+
+static inline unsigned
+lane_mask (__m256i v)
+{
+    return (unsigned) _mm256_movemask_ps (_mm256_castsi256_ps (v));
+}
+
+/* Unpack eight 12-bit pixels per lane from three words, see ufo_decode_frame_channels_v6 */
+static inline void
+unpack_12 (uint16_t *dst, __m256i w0, __m256i w1, __m256i w2)
+{
+    const __m256i mask_fff = _mm256_set1_epi32 (0xfff);
+    __m256i p0, p1, p2, p3, p4, p5, p6, p7;
+
+    p0 = _mm256_srli_epi32 (w0, 20);
+    p1 = _mm256_and_si256 (_mm256_srli_epi32 (w0, 8), mask_fff);
+    p2 = _mm256_or_si256 (_mm256_and_si256 (_mm256_slli_epi32 (w0, 4), mask_fff), _mm256_srli_epi32 (w1, 28));
+    p3 = _mm256_and_si256 (_mm256_srli_epi32 (w1, 16), mask_fff);
+    p4 = _mm256_and_si256 (_mm256_srli_epi32 (w1, 4), mask_fff);
+    p5 = _mm256_or_si256 (_mm256_and_si256 (_mm256_slli_epi32 (w1, 8), mask_fff), _mm256_srli_epi32 (w2, 24));
+    p6 = _mm256_and_si256 (_mm256_srli_epi32 (w2, 12), mask_fff);
+    p7 = _mm256_and_si256 (w2, mask_fff);
+
+    store_pair (dst + 0 * IPECAMERA_PIXELS_PER_CHANNEL, p0, p1);
+    store_pair (dst + 2 * IPECAMERA_PIXELS_PER_CHANNEL, p2, p3);
+    store_pair (dst + 4 * IPECAMERA_PIXELS_PER_CHANNEL, p4, p5);
+    store_pair (dst + 6 * IPECAMERA_PIXELS_PER_CHANNEL, p6, p7);
+}
+
+/*
+ * Check that the eight blocks are proper payload blocks of the same row with
+ * consecutive pixel numbers. Returns a non-zero mask otherwise.
+ */
+static inline __m256i
+check_headers (__m256i h, __m256i row, __m256i pixel, uint32_t magic_mask, uint32_t magic)
+{
+    const __m256i lane = _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i ones = _mm256_set1_epi32 (-1);
+    __m256i bad;
+
+    bad = _mm256_cmpeq_epi32 (h, _mm256_set1_epi32 (0x0AAAAAAA));
+    bad = _mm256_or_si256 (bad, _mm256_cmpeq_epi32 (_mm256_and_si256 (h, _mm256_set1_epi32 ((int) magic_mask)),
+                                                    _mm256_set1_epi32 ((int) magic)));
+    bad = _mm256_or_si256 (bad, _mm256_xor_si256 (_mm256_cmpeq_epi32 (row, _mm256_set1_epi32 (_mm256_extract_epi32 (row, 0))), ones));
+    bad = _mm256_or_si256 (bad, _mm256_xor_si256 (_mm256_cmpeq_epi32 (pixel, _mm256_add_epi32 (_mm256_set1_epi32 (_mm256_extract_epi32 (pixel, 0)), lane)), ones));
+
+    return bad;
+}
+
+/* Unpack eight 11-bit pixels per lane from three words, see ufo_decode_pixels_v6_11 */
+static inline void
+unpack_11 (uint16_t *dst, __m256i w0, __m256i w1, __m256i w2)
+{
+    const __m256i mask_7ff = _mm256_set1_epi32 (0x7ff);
+    __m256i p0, p1, p2, p3, p4, p5, p6, p7;
+
+    p0 = _mm256_srli_epi32 (w0, 21);
+    p1 = _mm256_and_si256 (_mm256_srli_epi32 (w0, 10), mask_7ff);
+    p2 = _mm256_and_si256 (_mm256_or_si256 (_mm256_slli_epi32 (w0, 1), _mm256_srli_epi32 (w1, 31)), mask_7ff);
+    p3 = _mm256_and_si256 (_mm256_srli_epi32 (w1, 20), mask_7ff);
+    p4 = _mm256_and_si256 (_mm256_srli_epi32 (w1, 9), mask_7ff);
+    p5 = _mm256_and_si256 (_mm256_or_si256 (_mm256_slli_epi32 (w1, 2), _mm256_srli_epi32 (w2, 30)), mask_7ff);
+    p6 = _mm256_and_si256 (_mm256_srli_epi32 (w2, 19), mask_7ff);
+    p7 = _mm256_and_si256 (_mm256_srli_epi32 (w2, 8), mask_7ff);
+
+    store_pair (dst + 0 * IPECAMERA_PIXELS_PER_CHANNEL, p0, p1);
+    store_pair (dst + 2 * IPECAMERA_PIXELS_PER_CHANNEL, p2, p3);
+    store_pair (dst + 4 * IPECAMERA_PIXELS_PER_CHANNEL, p4, p5);
+    store_pair (dst + 6 * IPECAMERA_PIXELS_PER_CHANNEL, p6, p7);
+}
+
+static inline size_t
+decode_blocks_v5 (uint16_t *pixel_buffer, const uint32_t *raw, size_t num_blocks, size_t width, size_t num_rows)
+{
+    const __m256i mask_3ff = _mm256_set1_epi32 (0x3ff);
+    const __m256i mask_3 = _mm256_set1_epi32 (0x3);
+    size_t base = 0;
+
+    for (; num_blocks >= NUM_BLOCKS; num_blocks -= NUM_BLOCKS, base += 8 * NUM_BLOCKS) {
+        const payload_header_v5 *header = (const payload_header_v5 *) &raw[base];
+        __m256i r[8];
+        __m256i bad;
+
+        for (int i = 0; i < 8; i++)
+            r[i] = _mm256_loadu_si256 ((const __m256i *) (raw + base + 8 * i));
+
+        transpose_8x8 (r);
+
+        bad = check_headers (r[0],
+                             _mm256_and_si256 (_mm256_srli_epi32 (r[0], 8), _mm256_set1_epi32 (0xfff)),
+                             _mm256_and_si256 (r[0], _mm256_set1_epi32 (0xff)),
+                             0xFF000000, 0xC0000000);
+
+        if (!_mm256_testz_si256 (bad, bad))
+            break;
+
+        /* Blocks outside of the frame are skipped by the caller */
+        if (!ufo_block_fits (header->row_number, header->pixel_number + NUM_BLOCKS - 1 + 15 * IPECAMERA_PIXELS_PER_CHANNEL,
+                             width, num_rows))
+            break;
+
+        uint16_t *dst = pixel_buffer + header->row_number * width + header->pixel_number;
+        const __m256i w0 = r[2], w1 = r[3], w2 = r[4], w3 = r[5], w4 = r[6], w5 = r[7];
+
+        /* Same bit positions as the scalar code in ufo_decode_frame_channels_v5 */
+        store_pair (dst + 0 * IPECAMERA_PIXELS_PER_CHANNEL,
+                    _mm256_and_si256 (_mm256_srli_epi32 (w5, 12), mask_3ff),
+                    _mm256_and_si256 (w5, mask_3ff));
+        store_pair (dst + 2 * IPECAMERA_PIXELS_PER_CHANNEL,
+                    _mm256_and_si256 (_mm256_srli_epi32 (w4, 16), mask_3ff),
+                    _mm256_or_si256 (_mm256_slli_epi32 (_mm256_and_si256 (w4, mask_3), 8), _mm256_srli_epi32 (w5, 24)));
+        store_pair (dst + 4 * IPECAMERA_PIXELS_PER_CHANNEL,
+                    _mm256_and_si256 (_mm256_srli_epi32 (w4, 4), mask_3ff),
+                    _mm256_and_si256 (_mm256_or_si256 (_mm256_slli_epi32 (w3, 4), _mm256_srli_epi32 (w4, 28)), mask_3ff));
+        store_pair (dst + 6 * IPECAMERA_PIXELS_PER_CHANNEL,
+                    _mm256_and_si256 (_mm256_srli_epi32 (w3, 8), mask_3ff),
+                    _mm256_and_si256 (w2, mask_3ff));
+        store_pair (dst + 8 * IPECAMERA_PIXELS_PER_CHANNEL,
+                    _mm256_or_si256 (_mm256_slli_epi32 (_mm256_and_si256 (w1, mask_3), 8), _mm256_srli_epi32 (w2, 24)),
+                    _mm256_and_si256 (_mm256_srli_epi32 (w3, 20), mask_3ff));
+        store_pair (dst + 10 * IPECAMERA_PIXELS_PER_CHANNEL,
+                    _mm256_and_si256 (_mm256_srli_epi32 (w1, 4), mask_3ff),
+                    _mm256_and_si256 (_mm256_srli_epi32 (w2, 12), mask_3ff));
+        store_pair (dst + 12 * IPECAMERA_PIXELS_PER_CHANNEL,
+                    _mm256_and_si256 (_mm256_srli_epi32 (w1, 16), mask_3ff),
+                    _mm256_and_si256 (_mm256_srli_epi32 (w0, 8), mask_3ff));
+        store_pair (dst + 14 * IPECAMERA_PIXELS_PER_CHANNEL,
+                    _mm256_and_si256 (_mm256_or_si256 (_mm256_slli_epi32 (w0, 4), _mm256_srli_epi32 (w1, 28)), mask_3ff),
+                    _mm256_and_si256 (_mm256_srli_epi32 (w0, 20), mask_3ff));
+    }
+
+    return base;
+}
+
+/*
+ * The 0xe0 and 0xc0 blocks of the 4 channel mode only change the channel
+ * offset. Instead of branching on every block, the block types of eight blocks
+ * are turned into bit masks, and the offset after a run of such blocks follows
+ * from the position of the last 0xc0 and the number of 0xe0 blocks after it.
+ */
+static inline size_t
+decode_blocks_v5_4ch (uint16_t *pixel_buffer, const uint32_t *raw, size_t num_blocks, size_t *off, size_t width,
+                      size_t num_rows)
+{
+    const __m256i mask_fff = _mm256_set1_epi32 (0xfff);
+    size_t base = 0;
+
+    while (num_blocks >= NUM_BLOCKS) {
+        const uint32_t *block = raw + base;
+        const payload_header_v5 *header = (const payload_header_v5 *) block;
+        __m256i r[8];
+        unsigned e0, c0, footer, markers, n;
+
+        for (int i = 0; i < 8; i++)
+            r[i] = _mm256_loadu_si256 ((const __m256i *) (block + 8 * i));
+
+        transpose_8x8 (r);
+
+        e0 = lane_mask (_mm256_cmpeq_epi32 (_mm256_srli_epi32 (r[0], 24), _mm256_set1_epi32 (0xe0)));
+        c0 = lane_mask (_mm256_cmpeq_epi32 (_mm256_srli_epi32 (r[0], 24), _mm256_set1_epi32 (0xc0)));
+        footer = lane_mask (_mm256_cmpeq_epi32 (r[0], _mm256_set1_epi32 (0x0AAAAAAA)));
+        markers = e0 | c0;
+
+        if ((markers | footer) == 0) {
+            const __m256i bad = check_headers (r[0],
+                                               _mm256_and_si256 (_mm256_srli_epi32 (r[0], 8), mask_fff),
+                                               _mm256_and_si256 (r[0], _mm256_set1_epi32 (0xff)),
+                                               0xFF000000, 0xC0000000);
+
+            /* Groups that do not fit into the frame are left to ufo_decode_block_v5_4ch */
+            if (_mm256_testz_si256 (bad, bad) &&
+                ufo_block_fits (header->row_number,
+                                header->pixel_number + NUM_BLOCKS - 1 + (*off + 12) * IPECAMERA_PIXELS_PER_CHANNEL,
+                                width, num_rows)) {
+                uint16_t *dst = pixel_buffer + header->row_number * width + header->pixel_number + *off * IPECAMERA_PIXELS_PER_CHANNEL;
+
+                store_two (dst + 0 * IPECAMERA_PIXELS_PER_CHANNEL, dst + 4 * IPECAMERA_PIXELS_PER_CHANNEL,
+                           _mm256_and_si256 (_mm256_srli_epi32 (r[7], 12), mask_fff),
+                           _mm256_and_si256 (_mm256_srli_epi32 (r[6], 4), mask_fff));
+                store_two (dst + 8 * IPECAMERA_PIXELS_PER_CHANNEL, dst + 12 * IPECAMERA_PIXELS_PER_CHANNEL,
+                           _mm256_or_si256 (_mm256_slli_epi32 (_mm256_and_si256 (r[3], _mm256_set1_epi32 (0xf)), 8), _mm256_srli_epi32 (r[4], 24)),
+                           _mm256_and_si256 (_mm256_srli_epi32 (r[3], 16), mask_fff));
+
+                base += 8 * NUM_BLOCKS;
+                num_blocks -= NUM_BLOCKS;
+                continue;
+            }
+
+            n = NUM_BLOCKS;
+        }
+        else if (markers & 1) {
+            unsigned run;
+
+            /* A run of marker blocks */
+            n = __builtin_ctz (~markers);
+            run = (1 << n) - 1;
+
+            if (c0 & run) {
+                const unsigned last = 31 - __builtin_clz (c0 & run);
+                *off = __builtin_popcount (e0 & run & ~((2 << last) - 1));
+            }
+            else
+                *off += __builtin_popcount (e0 & run);
+
+            base += 8 * n;
+            num_blocks -= n;
+            continue;
+        }
+        else {
+            /* Pixel blocks in front of a marker block or the footer */
+            n = __builtin_ctz (markers | footer);
+
+            if (n == 0)
+                break;
+        }
+
+        for (unsigned i = 0; i < n; i++) {
+            if (ufo_is_frame_header (block + 8 * i))
+                return base + 8 * i;
+
+            ufo_decode_block_v5_4ch (pixel_buffer, block + 8 * i, off, width, num_rows);
+        }
+
+        base += 8 * n;
+        num_blocks -= n;
+    }
+
+    return base;
+}
+
+static inline size_t
+decode_blocks_v6 (uint16_t *pixel_buffer, const uint32_t *raw, size_t num_blocks, uint16_t start_offset, int adc_bits,
+                  size_t width, size_t num_rows)
+{
+    const __m256i mask_fff = _mm256_set1_epi32 (0xfff);
+    size_t base = 0;
+
+    for (; num_blocks >= NUM_BLOCKS; num_blocks -= NUM_BLOCKS, base += 8 * NUM_BLOCKS) {
+        const uint32_t row = raw[base] & 0xfff;
+        const uint32_t pixel = (raw[base + 1] >> 16) & 0xfff;
+        __m256i r[8];
+        __m256i bad;
+
+        for (int i = 0; i < 8; i++)
+            r[i] = _mm256_loadu_si256 ((const __m256i *) (raw + base + 8 * i));
+
+        transpose_8x8 (r);
+
+        /* Leave anything irregular to the caller */
+        bad = check_headers (r[0],
+                             _mm256_and_si256 (r[0], mask_fff),
+                             _mm256_and_si256 (_mm256_srli_epi32 (r[1], 16), mask_fff),
+                             0xFF000000, 0xC0000000);
+
+        if (!_mm256_testz_si256 (bad, bad))
+            break;
+
+        if (!ufo_block_fits_v6 ((size_t) (row - start_offset), pixel + NUM_BLOCKS - 1, width, num_rows))
+            break;
+
+        const size_t index = (size_t) (row - start_offset) * width + pixel;
+
+        if (adc_bits == 11) {
+            unpack_11 (pixel_buffer + index, r[2], r[3], r[4]);
+            unpack_11 (pixel_buffer + index + IPECAMERA_V6_SECOND_HALF (width), r[5], r[6], r[7]);
+        }
+        else {
+            unpack_12 (pixel_buffer + index, r[2], r[3], r[4]);
+            unpack_12 (pixel_buffer + index + IPECAMERA_V6_SECOND_HALF (width), r[5], r[6], r[7]);
+        }
+    }
+
+    return base;
+}
+
+/*
+ * The row stride is a constant for the common sensor widths, so that the
+ * compiler can fold it into the address computations.
+ */
+#define DEFINE_KERNELS(name, stride) \
+static size_t \
+name##_v5 (uint16_t *pixel_buffer, const uint32_t *raw, size_t num_blocks, size_t width, size_t num_rows) \
+{ \
+    (void) width; \
+    return decode_blocks_v5 (pixel_buffer, raw, num_blocks, stride, num_rows); \
+} \
+\
+static size_t \
+name##_v5_4ch (uint16_t *pixel_buffer, const uint32_t *raw, size_t num_blocks, size_t *off, size_t width, \
+                size_t num_rows) \
+{ \
+    (void) width; \
+    return decode_blocks_v5_4ch (pixel_buffer, raw, num_blocks, off, stride, num_rows); \
+} \
+\
+static size_t \
+name##_v6 (uint16_t *pixel_buffer, const uint32_t *raw, size_t num_blocks, uint16_t start_offset, size_t width, \
+            size_t num_rows) \
+{ \
+    (void) width; \
+    return decode_blocks_v6 (pixel_buffer, raw, num_blocks, start_offset, 12, stride, num_rows); \
+} \
+\
+static size_t \
+name##_v6_11 (uint16_t *pixel_buffer, const uint32_t *raw, size_t num_blocks, uint16_t start_offset, size_t width, \
+               size_t num_rows) \
+{ \
+    (void) width; \
+    return decode_blocks_v6 (pixel_buffer, raw, num_blocks, start_offset, 11, stride, num_rows); \
+} \
+\
+static const UfoKernels name = { name##_v5, name##_v5_4ch, name##_v6, name##_v6_11 };
+
+DEFINE_KERNELS (kernels_any, width)
+DEFINE_KERNELS (kernels_2048, 2048)
+DEFINE_KERNELS (kernels_5120, 5120)
+
+const UfoKernels *
+ufo_get_kernels_avx2 (size_t width)
+{
+    switch (width) {
+        case 2048:
+            return &kernels_2048;
+        case 5120:
+            return &kernels_5120;
+        default:
+            return &kernels_any;
+    }
+}
+
+/* Eight pixels of a row, widened to 32 bit */
+static inline __m256i
+load_pixels (const uint16_t *src)
+{
+    return _mm256_cvtepu16_epi32 (_mm_loadu_si128 ((const __m128i *) src));
+}
+
+static inline __m256i
+scale_pixels (__m256i v, __m256i max, __m256i factor)
+{
+    return _mm256_srli_epi32 (_mm256_mullo_epi32 (_mm256_min_epu32 (v, max), factor), 23);
+}
+
+/*
+ * Eight pixels starting at an odd x are interpolated at once. Lanes 1, 3, 5
+ * and 7 hold the even columns, whose channels are blended in with 0xAA.
+ */
+void
+ufo_convert_bayer_row_avx2 (const uint16_t *row, uint8_t *out, int width, int y, uint32_t max, uint32_t factor)
+{
+    const uint16_t *up = row - width;
+    const uint16_t *down = row + width;
+    const __m256i max_v = _mm256_set1_epi32 (max);
+    const __m256i factor_v = _mm256_set1_epi32 (factor);
+    const __m256i pack_rgb = _mm256_setr_epi8 (0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                               0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    int x = 1;
+
+    for (; x + 7 <= width - 2; x += 8) {
+        const __m256i c = load_pixels (row + x);
+        const __m256i l = load_pixels (row + x - 1);
+        const __m256i r = load_pixels (row + x + 1);
+        const __m256i u = load_pixels (up + x);
+        const __m256i d = load_pixels (down + x);
+        const __m256i lr = _mm256_add_epi32 (l, r);
+        const __m256i ud = _mm256_add_epi32 (u, d);
+        const __m256i h2 = _mm256_srli_epi32 (lr, 1);
+        const __m256i v2 = _mm256_srli_epi32 (ud, 1);
+        const __m256i x4 = _mm256_srli_epi32 (_mm256_add_epi32 (lr, ud), 2);
+        const __m256i d4 = _mm256_srli_epi32 (_mm256_add_epi32 (_mm256_add_epi32 (load_pixels (up + x - 1),
+                                                                                  load_pixels (up + x + 1)),
+                                                                _mm256_add_epi32 (load_pixels (down + x - 1),
+                                                                                  load_pixels (down + x + 1))), 2);
+        __m256i red, green, blue, rgb;
+
+        if ((y & 1) == 0) {
+            red = _mm256_blend_epi32 (h2, c, 0xAA);
+            green = _mm256_blend_epi32 (c, x4, 0xAA);
+            blue = _mm256_blend_epi32 (v2, d4, 0xAA);
+        }
+        else {
+            red = _mm256_blend_epi32 (d4, v2, 0xAA);
+            green = _mm256_blend_epi32 (x4, c, 0xAA);
+            blue = _mm256_blend_epi32 (c, h2, 0xAA);
+        }
+
+        red = scale_pixels (red, max_v, factor_v);
+        green = scale_pixels (green, max_v, factor_v);
+        blue = scale_pixels (blue, max_v, factor_v);
+
+        rgb = _mm256_or_si256 (red, _mm256_or_si256 (_mm256_slli_epi32 (green, 8), _mm256_slli_epi32 (blue, 16)));
+        rgb = _mm256_shuffle_epi8 (rgb, pack_rgb);
+
+        /* The first store spills four bytes that the second one overwrites */
+        const __m128i hi = _mm256_extracti128_si256 (rgb, 1);
+        const uint32_t last = (uint32_t) _mm_extract_epi32 (hi, 2);
+
+        _mm_storeu_si128 ((__m128i *) (out + 3 * x), _mm256_castsi256_si128 (rgb));
+        _mm_storel_epi64 ((__m128i *) (out + 3 * x + 12), hi);
+        memcpy (out + 3 * x + 20, &last, sizeof (uint32_t));
+    }
+
+    for (; x < width - 1; x++)
+        ufo_convert_bayer_pixel (row, out, width, x, y, max, factor);
+}
+
+void
+ufo_average_rows_avx2 (const uint16_t *a, const uint16_t *b, uint16_t *out, size_t num_pixels)
+{
+    size_t i = 0;
+
+    /* pavgw rounds up, so take off what it added for odd sums */
+    for (; i + 16 <= num_pixels; i += 16) {
+        const __m256i va = _mm256_loadu_si256 ((const __m256i *) (a + i));
+        const __m256i vb = _mm256_loadu_si256 ((const __m256i *) (b + i));
+        const __m256i odd = _mm256_and_si256 (_mm256_xor_si256 (va, vb), _mm256_set1_epi16 (1));
+
+        _mm256_storeu_si256 ((__m256i *) (out + i), _mm256_sub_epi16 (_mm256_avg_epu16 (va, vb), odd));
+    }
+
+    for (; i < num_pixels; i++)
+        out[i] = (a[i] & b[i]) + ((a[i] ^ b[i]) >> 1);
+}
+
+static inline __m256i
+match_markers (const uint32_t *raw)
+{
+    const __m256i v = _mm256_loadu_si256 ((const __m256i *) raw);
+    const __m256i start = _mm256_cmpeq_epi32 (_mm256_and_si256 (v, _mm256_set1_epi32 ((int) 0xFFFFFFF0)),
+                                              _mm256_set1_epi32 (0x51111110));
+
+    return _mm256_or_si256 (start, _mm256_cmpeq_epi32 (v, _mm256_set1_epi32 (0x0AAAAAAA)));
+}
+
+/*
+ * Four registers are tested at once, the position is only worked out for the
+ * register that matched.
+ */
+size_t
+ufo_find_marker_avx2 (const uint32_t *raw, size_t num_words)
+{
+    size_t i = 0;
+
+    for (; i + 32 <= num_words; i += 32) {
+        const __m256i any = _mm256_or_si256 (_mm256_or_si256 (match_markers (raw + i), match_markers (raw + i + 8)),
+                                             _mm256_or_si256 (match_markers (raw + i + 16), match_markers (raw + i + 24)));
+
+        if (!_mm256_testz_si256 (any, any))
+            break;
+    }
+
+    for (; i + 8 <= num_words; i += 8) {
+        const unsigned mask = lane_mask (match_markers (raw + i));
+
+        if (mask)
+            return i + __builtin_ctz (mask);
+    }
+
+    for (; i < num_words; i++) {
+        if (ufo_is_marker (raw[i]))
+            return i;
+    }
+
+    return num_words;
+}
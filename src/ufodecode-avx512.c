@@ -0,0 +1,345 @@
+#include <immintrin.h>
+#include "config.h"
+#include "ufodecode-private.h"
+
+/*
+ * Same scheme as the AVX2 kernel but with sixteen blocks per iteration. The
+ * words are gathered with a stride of one block, so that lane k holds block k
+ * and each channel is written as sixteen adjacent pixels.
+ */
+
+#define NUM_BLOCKS  16
+
+static inline __mmask16
+check_headers (__m512i h, __m512i row, __m512i pixel, uint32_t magic_mask, uint32_t magic)
+{
+    const __m512i lane = _mm512_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i first_row = _mm512_castsi512_si128 (row);
+    const __m128i first_pixel = _mm512_castsi512_si128 (pixel);
+    __mmask16 bad;
+
+    bad = _mm512_cmpeq_epi32_mask (h, _mm512_set1_epi32 (0x0AAAAAAA));
+    bad |= _mm512_cmpeq_epi32_mask (_mm512_and_si512 (h, _mm512_set1_epi32 ((int) magic_mask)), _mm512_set1_epi32 ((int) magic));
+    bad |= _mm512_cmpneq_epi32_mask (row, _mm512_broadcastd_epi32 (first_row));
+    bad |= _mm512_cmpneq_epi32_mask (pixel, _mm512_add_epi32 (_mm512_broadcastd_epi32 (first_pixel), lane));
+
+    return bad;
+}
+
+static inline void
+store (uint16_t *dst, int channel, __m512i v)
+{
+    _mm256_storeu_si256 ((__m256i *) (dst + channel * IPECAMERA_PIXELS_PER_CHANNEL), _mm512_cvtepi32_epi16 (v));
+}
+
+static inline void
+unpack_12 (uint16_t *dst, __m512i w0, __m512i w1, __m512i w2)
+{
+    const __m512i mask_fff = _mm512_set1_epi32 (0xfff);
+
+    store (dst, 0, _mm512_srli_epi32 (w0, 20));
+    store (dst, 1, _mm512_and_si512 (_mm512_srli_epi32 (w0, 8), mask_fff));
+    store (dst, 2, _mm512_or_si512 (_mm512_and_si512 (_mm512_slli_epi32 (w0, 4), mask_fff), _mm512_srli_epi32 (w1, 28)));
+    store (dst, 3, _mm512_and_si512 (_mm512_srli_epi32 (w1, 16), mask_fff));
+    store (dst, 4, _mm512_and_si512 (_mm512_srli_epi32 (w1, 4), mask_fff));
+    store (dst, 5, _mm512_or_si512 (_mm512_and_si512 (_mm512_slli_epi32 (w1, 8), mask_fff), _mm512_srli_epi32 (w2, 24)));
+    store (dst, 6, _mm512_and_si512 (_mm512_srli_epi32 (w2, 12), mask_fff));
+    store (dst, 7, _mm512_and_si512 (w2, mask_fff));
+}
+
+static inline void
+unpack_11 (uint16_t *dst, __m512i w0, __m512i w1, __m512i w2)
+{
+    const __m512i mask_7ff = _mm512_set1_epi32 (0x7ff);
+
+    store (dst, 0, _mm512_srli_epi32 (w0, 21));
+    store (dst, 1, _mm512_and_si512 (_mm512_srli_epi32 (w0, 10), mask_7ff));
+    store (dst, 2, _mm512_and_si512 (_mm512_or_si512 (_mm512_slli_epi32 (w0, 1), _mm512_srli_epi32 (w1, 31)), mask_7ff));
+    store (dst, 3, _mm512_and_si512 (_mm512_srli_epi32 (w1, 20), mask_7ff));
+    store (dst, 4, _mm512_and_si512 (_mm512_srli_epi32 (w1, 9), mask_7ff));
+    store (dst, 5, _mm512_and_si512 (_mm512_or_si512 (_mm512_slli_epi32 (w1, 2), _mm512_srli_epi32 (w2, 30)), mask_7ff));
+    store (dst, 6, _mm512_and_si512 (_mm512_srli_epi32 (w2, 19), mask_7ff));
+    store (dst, 7, _mm512_and_si512 (_mm512_srli_epi32 (w2, 8), mask_7ff));
+}
+
+static inline size_t
+decode_blocks_v5 (uint16_t *pixel_buffer, const uint32_t *raw, size_t num_blocks, size_t width, size_t num_rows)
+{
+    const __m512i stride = _mm512_setr_epi32 (0, 8, 16, 24, 32, 40, 48, 56, 64, 72, 80, 88, 96, 104, 112, 120);
+    const __m512i mask_3ff = _mm512_set1_epi32 (0x3ff);
+    const __m512i mask_3 = _mm512_set1_epi32 (0x3);
+    size_t base = 0;
+
+    for (; num_blocks >= NUM_BLOCKS; num_blocks -= NUM_BLOCKS, base += 8 * NUM_BLOCKS) {
+        const uint32_t *block = raw + base;
+        const payload_header_v5 *header = (const payload_header_v5 *) block;
+        const __m512i h = _mm512_i32gather_epi32 (stride, (const void *) block, 4);
+
+        if (check_headers (h,
+                           _mm512_and_si512 (_mm512_srli_epi32 (h, 8), _mm512_set1_epi32 (0xfff)),
+                           _mm512_and_si512 (h, _mm512_set1_epi32 (0xff)),
+                           0xFF000000, 0xC0000000))
+            break;
+
+        /* Blocks outside of the frame are skipped by the caller */
+        if (!ufo_block_fits (header->row_number, header->pixel_number + NUM_BLOCKS - 1 + 15 * IPECAMERA_PIXELS_PER_CHANNEL,
+                             width, num_rows))
+            break;
+
+        uint16_t *dst = pixel_buffer + header->row_number * width + header->pixel_number;
+        const __m512i w0 = _mm512_i32gather_epi32 (stride, (const void *) (block + 2), 4);
+        const __m512i w1 = _mm512_i32gather_epi32 (stride, (const void *) (block + 3), 4);
+        const __m512i w2 = _mm512_i32gather_epi32 (stride, (const void *) (block + 4), 4);
+        const __m512i w3 = _mm512_i32gather_epi32 (stride, (const void *) (block + 5), 4);
+        const __m512i w4 = _mm512_i32gather_epi32 (stride, (const void *) (block + 6), 4);
+        const __m512i w5 = _mm512_i32gather_epi32 (stride, (const void *) (block + 7), 4);
+
+        /* Same bit positions as the scalar code in ufo_decode_frame_channels_v5 */
+        store (dst, 15, _mm512_and_si512 (_mm512_srli_epi32 (w0, 20), mask_3ff));
+        store (dst, 13, _mm512_and_si512 (_mm512_srli_epi32 (w0, 8), mask_3ff));
+        store (dst, 14, _mm512_and_si512 (_mm512_or_si512 (_mm512_slli_epi32 (w0, 4), _mm512_srli_epi32 (w1, 28)), mask_3ff));
+        store (dst, 12, _mm512_and_si512 (_mm512_srli_epi32 (w1, 16), mask_3ff));
+        store (dst, 10, _mm512_and_si512 (_mm512_srli_epi32 (w1, 4), mask_3ff));
+        store (dst,  8, _mm512_or_si512 (_mm512_slli_epi32 (_mm512_and_si512 (w1, mask_3), 8), _mm512_srli_epi32 (w2, 24)));
+        store (dst, 11, _mm512_and_si512 (_mm512_srli_epi32 (w2, 12), mask_3ff));
+        store (dst,  7, _mm512_and_si512 (w2, mask_3ff));
+        store (dst,  9, _mm512_and_si512 (_mm512_srli_epi32 (w3, 20), mask_3ff));
+        store (dst,  6, _mm512_and_si512 (_mm512_srli_epi32 (w3, 8), mask_3ff));
+        store (dst,  5, _mm512_and_si512 (_mm512_or_si512 (_mm512_slli_epi32 (w3, 4), _mm512_srli_epi32 (w4, 28)), mask_3ff));
+        store (dst,  2, _mm512_and_si512 (_mm512_srli_epi32 (w4, 16), mask_3ff));
+        store (dst,  4, _mm512_and_si512 (_mm512_srli_epi32 (w4, 4), mask_3ff));
+        store (dst,  3, _mm512_or_si512 (_mm512_slli_epi32 (_mm512_and_si512 (w4, mask_3), 8), _mm512_srli_epi32 (w5, 24)));
+        store (dst,  0, _mm512_and_si512 (_mm512_srli_epi32 (w5, 12), mask_3ff));
+        store (dst,  1, _mm512_and_si512 (w5, mask_3ff));
+    }
+
+    return base;
+}
+
+/*
+ * The 0xe0 and 0xc0 blocks of the 4 channel mode only change the channel
+ * offset. Instead of branching on every block, the block types of sixteen
+ * blocks are turned into bit masks, and the offset after a run of such blocks
+ * follows from the position of the last 0xc0 and the number of 0xe0 blocks
+ * after it, just as in decode_blocks_v5_4ch of ufodecode-avx2.c.
+ */
+static inline size_t
+decode_blocks_v5_4ch (uint16_t *pixel_buffer, const uint32_t *raw, size_t num_blocks, size_t *off, size_t width,
+                      size_t num_rows)
+{
+    const __m512i stride = _mm512_setr_epi32 (0, 8, 16, 24, 32, 40, 48, 56, 64, 72, 80, 88, 96, 104, 112, 120);
+    const __m512i mask_fff = _mm512_set1_epi32 (0xfff);
+    size_t base = 0;
+
+    while (num_blocks >= NUM_BLOCKS) {
+        const uint32_t *block = raw + base;
+        const payload_header_v5 *header = (const payload_header_v5 *) block;
+        const __m512i h = _mm512_i32gather_epi32 (stride, (const void *) block, 4);
+        const __m512i magic = _mm512_srli_epi32 (h, 24);
+        const unsigned e0 = _mm512_cmpeq_epi32_mask (magic, _mm512_set1_epi32 (0xe0));
+        const unsigned c0 = _mm512_cmpeq_epi32_mask (magic, _mm512_set1_epi32 (0xc0));
+        const unsigned footer = _mm512_cmpeq_epi32_mask (h, _mm512_set1_epi32 (0x0AAAAAAA));
+        const unsigned markers = e0 | c0;
+        unsigned n;
+
+        if ((markers | footer) == 0) {
+            /* Groups that do not fit into the frame are left to ufo_decode_block_v5_4ch */
+            if (!check_headers (h,
+                                _mm512_and_si512 (_mm512_srli_epi32 (h, 8), mask_fff),
+                                _mm512_and_si512 (h, _mm512_set1_epi32 (0xff)),
+                                0xFF000000, 0xC0000000) &&
+                ufo_block_fits (header->row_number,
+                                header->pixel_number + NUM_BLOCKS - 1 + (*off + 12) * IPECAMERA_PIXELS_PER_CHANNEL,
+                                width, num_rows)) {
+                uint16_t *dst = pixel_buffer + header->row_number * width + header->pixel_number + *off * IPECAMERA_PIXELS_PER_CHANNEL;
+                const __m512i w1 = _mm512_i32gather_epi32 (stride, (const void *) (block + 3), 4);
+                const __m512i w2 = _mm512_i32gather_epi32 (stride, (const void *) (block + 4), 4);
+                const __m512i w4 = _mm512_i32gather_epi32 (stride, (const void *) (block + 6), 4);
+                const __m512i w5 = _mm512_i32gather_epi32 (stride, (const void *) (block + 7), 4);
+
+                store (dst,  0, _mm512_and_si512 (_mm512_srli_epi32 (w5, 12), mask_fff));
+                store (dst,  4, _mm512_and_si512 (_mm512_srli_epi32 (w4, 4), mask_fff));
+                store (dst,  8, _mm512_or_si512 (_mm512_slli_epi32 (_mm512_and_si512 (w1, _mm512_set1_epi32 (0xf)), 8), _mm512_srli_epi32 (w2, 24)));
+                store (dst, 12, _mm512_and_si512 (_mm512_srli_epi32 (w1, 16), mask_fff));
+
+                base += 8 * NUM_BLOCKS;
+                num_blocks -= NUM_BLOCKS;
+                continue;
+            }
+
+            n = NUM_BLOCKS;
+        }
+        else if (markers & 1) {
+            unsigned run;
+
+            n = __builtin_ctz (~markers);
+            run = (1 << n) - 1;
+
+            if (c0 & run) {
+                const unsigned last = 31 - __builtin_clz (c0 & run);
+                *off = __builtin_popcount (e0 & run & ~((2 << last) - 1));
+            }
+            else
+                *off += __builtin_popcount (e0 & run);
+
+            base += 8 * n;
+            num_blocks -= n;
+            continue;
+        }
+        else {
+            n = __builtin_ctz (markers | footer);
+
+            if (n == 0)
+                break;
+        }
+
+        for (unsigned i = 0; i < n; i++) {
+            if (ufo_is_frame_header (block + 8 * i))
+                return base + 8 * i;
+
+            ufo_decode_block_v5_4ch (pixel_buffer, block + 8 * i, off, width, num_rows);
+        }
+
+        base += 8 * n;
+        num_blocks -= n;
+    }
+
+    return base;
+}
+
+static inline size_t
+decode_blocks_v6 (uint16_t *pixel_buffer, const uint32_t *raw, size_t num_blocks, uint16_t start_offset, int adc_bits,
+                  size_t width, size_t num_rows)
+{
+    const __m512i stride = _mm512_setr_epi32 (0, 8, 16, 24, 32, 40, 48, 56, 64, 72, 80, 88, 96, 104, 112, 120);
+    const __m512i mask_fff = _mm512_set1_epi32 (0xfff);
+    size_t base = 0;
+
+    for (; num_blocks >= NUM_BLOCKS; num_blocks -= NUM_BLOCKS, base += 8 * NUM_BLOCKS) {
+        const uint32_t *block = raw + base;
+        const uint32_t row = block[0] & 0xfff;
+        const uint32_t pixel = (block[1] >> 16) & 0xfff;
+        const __m512i h0 = _mm512_i32gather_epi32 (stride, (const void *) (block + 0), 4);
+        const __m512i h1 = _mm512_i32gather_epi32 (stride, (const void *) (block + 1), 4);
+
+        if (check_headers (h0,
+                           _mm512_and_si512 (h0, mask_fff),
+                           _mm512_and_si512 (_mm512_srli_epi32 (h1, 16), mask_fff),
+                           0xFF000000, 0xC0000000))
+            break;
+
+        if (!ufo_block_fits_v6 ((size_t) (row - start_offset), pixel + NUM_BLOCKS - 1, width, num_rows))
+            break;
+
+        const size_t index = (size_t) (row - start_offset) * width + pixel;
+
+        const __m512i w0 = _mm512_i32gather_epi32 (stride, (const void *) (block + 2), 4);
+        const __m512i w1 = _mm512_i32gather_epi32 (stride, (const void *) (block + 3), 4);
+        const __m512i w2 = _mm512_i32gather_epi32 (stride, (const void *) (block + 4), 4);
+        const __m512i w3 = _mm512_i32gather_epi32 (stride, (const void *) (block + 5), 4);
+        const __m512i w4 = _mm512_i32gather_epi32 (stride, (const void *) (block + 6), 4);
+        const __m512i w5 = _mm512_i32gather_epi32 (stride, (const void *) (block + 7), 4);
+
+        if (adc_bits == 11) {
+            unpack_11 (pixel_buffer + index, w0, w1, w2);
+            unpack_11 (pixel_buffer + index + IPECAMERA_V6_SECOND_HALF (width), w3, w4, w5);
+        }
+        else {
+            unpack_12 (pixel_buffer + index, w0, w1, w2);
+            unpack_12 (pixel_buffer + index + IPECAMERA_V6_SECOND_HALF (width), w3, w4, w5);
+        }
+    }
+
+    return base;
+}
+
+static inline __mmask16
+match_markers (__m512i v)
+{
+    const __mmask16 start = _mm512_cmpeq_epi32_mask (_mm512_and_si512 (v, _mm512_set1_epi32 ((int) 0xFFFFFFF0)),
+                                                     _mm512_set1_epi32 (0x51111110));
+
+    return start | _mm512_cmpeq_epi32_mask (v, _mm512_set1_epi32 (0x0AAAAAAA));
+}
+
+/* See ufo_find_marker_avx2, the tail is handled with a masked load */
+size_t
+ufo_find_marker_avx512 (const uint32_t *raw, size_t num_words)
+{
+    size_t i = 0;
+
+    for (; i + 64 <= num_words; i += 64) {
+        const __mmask16 m0 = match_markers (_mm512_loadu_si512 (raw + i));
+        const __mmask16 m1 = match_markers (_mm512_loadu_si512 (raw + i + 16));
+        const __mmask16 m2 = match_markers (_mm512_loadu_si512 (raw + i + 32));
+        const __mmask16 m3 = match_markers (_mm512_loadu_si512 (raw + i + 48));
+
+        if (m0 | m1 | m2 | m3)
+            break;
+    }
+
+    for (; i < num_words; i += 16) {
+        const __mmask16 valid = num_words - i >= 16 ? 0xFFFF : (1 << (num_words - i)) - 1;
+        const __mmask16 mask = match_markers (_mm512_maskz_loadu_epi32 (valid, raw + i)) & valid;
+
+        if (mask)
+            return i + __builtin_ctz (mask);
+    }
+
+    return num_words;
+}
+
+/*
+ * The row stride is a constant for the common sensor widths, so that the
+ * compiler can fold it into the address computations.
+ */
+#define DEFINE_KERNELS(name, stride) \
+static size_t \
+name##_v5 (uint16_t *pixel_buffer, const uint32_t *raw, size_t num_blocks, size_t width, size_t num_rows) \
+{ \
+    (void) width; \
+    return decode_blocks_v5 (pixel_buffer, raw, num_blocks, stride, num_rows); \
+} \
+\
+static size_t \
+name##_v5_4ch (uint16_t *pixel_buffer, const uint32_t *raw, size_t num_blocks, size_t *off, size_t width, \
+                size_t num_rows) \
+{ \
+    (void) width; \
+    return decode_blocks_v5_4ch (pixel_buffer, raw, num_blocks, off, stride, num_rows); \
+} \
+\
+static size_t \
+name##_v6 (uint16_t *pixel_buffer, const uint32_t *raw, size_t num_blocks, uint16_t start_offset, size_t width, \
+            size_t num_rows) \
+{ \
+    (void) width; \
+    return decode_blocks_v6 (pixel_buffer, raw, num_blocks, start_offset, 12, stride, num_rows); \
+} \
+\
+static size_t \
+name##_v6_11 (uint16_t *pixel_buffer, const uint32_t *raw, size_t num_blocks, uint16_t start_offset, size_t width, \
+               size_t num_rows) \
+{ \
+    (void) width; \
+    return decode_blocks_v6 (pixel_buffer, raw, num_blocks, start_offset, 11, stride, num_rows); \
+} \
+\
+static const UfoKernels name = { name##_v5, name##_v5_4ch, name##_v6, name##_v6_11 };
+
+DEFINE_KERNELS (kernels_any, width)
+DEFINE_KERNELS (kernels_2048, 2048)
+DEFINE_KERNELS (kernels_5120, 5120)
+
+const UfoKernels *
+ufo_get_kernels_avx512 (size_t width)
+{
+    switch (width) {
+        case 2048:
+            return &kernels_2048;
+        case 5120:
+            return &kernels_5120;
+        default:
+            return &kernels_any;
+    }
+}
@@ -1,16 +1,383 @@
+
 #ifndef LIB_UFODECODE_PRIVATE_H
 #define LIB_UFODECODE_PRIVATE_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include "ufodecode.h"
+
+#define IPECAMERA_NUM_ROWS              1088
+#define IPECAMERA_MAX_ROWS              4096    /**< Rows addressable by a payload block */
+#define IPECAMERA_NUM_CHANNELS          16      /**< Number of channels per row */
+#define IPECAMERA_PIXELS_PER_CHANNEL    128     /**< Number of pixels per channel */
+#define IPECAMERA_MAX_STAGES            8       /**< Stages of a pipeline */
+#define IPECAMERA_TILE_BYTES            (256 * 1024)    /**< Input rows processed at once by a pipeline */
+#define IPECAMERA_MAX_BATCH             64      /**< Frames decoded at once by ufo_decoder_get_next_frames */
+#define IPECAMERA_LUT_SIZE              4096    /**< Entries of a table for UFO_STAGE_TO_8_BIT */
+#define IPECAMERA_FRAME_ALIGNMENT       4096    /**< Alignment of frames allocated by the decoder */
+
+/*
+ * Offset of the pixels in the second half of a v6 payload block. The SSE code
+ * puts them into the next row, the plain C code into the next eight channels.
+ * Every kernel follows the implementation that is compiled in.
+ */
+#ifdef HAVE_SSE
+# define IPECAMERA_V6_SECOND_HALF(width)    (width)
+#else
+# define IPECAMERA_V6_SECOND_HALF(width)    (8 * IPECAMERA_PIXELS_PER_CHANNEL)
+#endif
+
+typedef struct {
+    unsigned pixel_number : 8;
+    unsigned row_number : 12;
+    unsigned pixel_size : 4;
+    unsigned magic : 8;
+} payload_header_v5;
+
+/**
+ * Decode as many consecutive dataformat v6 payload blocks as possible
+ * starting at raw into a frame of num_rows rows of width pixels. At most
+ * num_blocks blocks are looked at. Returns the number of words consumed, which
+ * is 0 if the kernel could not handle the next block, e.g. because it does not
+ * fit into the frame.
+ */
+typedef size_t (*UfoDecodeBlocksV6Func) (uint16_t        *pixel_buffer,
+                                         const uint32_t  *raw,
+                                         size_t           num_blocks,
+                                         uint16_t         start_offset,
+                                         size_t           width,
+                                         size_t           num_rows);
+
+/**
+ * Same for dataformat v5 payload blocks in 16 channel mode.
+ */
+typedef size_t (*UfoDecodeBlocksV5Func) (uint16_t        *pixel_buffer,
+                                         const uint32_t  *raw,
+                                         size_t           num_blocks,
+                                         size_t           width,
+                                         size_t           num_rows);
+
+/**
+ * Same for dataformat v5 payload blocks in 4 channel mode. off is the channel
+ * offset that is carried from one call to the next.
+ */
+typedef size_t (*UfoDecodeBlocksV5_4chFunc) (uint16_t        *pixel_buffer,
+                                             const uint32_t  *raw,
+                                             size_t           num_blocks,
+                                             size_t          *off,
+                                             size_t           width,
+                                             size_t           num_rows);
+
+/**
+ * Return the offset of the first of num_words words at raw that may be the
+ * start of a frame header or footer, or num_words if there is none.
+ */
+typedef size_t (*UfoFindMarkerFunc) (const uint32_t  *raw,
+                                     size_t           num_words);
+
+/**
+ * Payload kernels of one instruction set, possibly specialized for a width.
+ */
+typedef struct {
+    UfoDecodeBlocksV5Func       v5;
+    UfoDecodeBlocksV5_4chFunc   v5_4ch;
+    UfoDecodeBlocksV6Func       v6;
+    UfoDecodeBlocksV6Func       v6_11;
+} UfoKernels;
+
+/**
+ * Convert the inner pixels 1 to width - 2 of row y of a Bayer pattern frame
+ * to RGB. row points to the row, which must be surrounded by the rows y - 1
+ * and y + 1, out to the output row. Values are clamped to max and scaled with
+ * ufo_bayer_scale.
+ */
+typedef void (*UfoBayerRowFunc) (const uint16_t  *row,
+                                 uint8_t         *out,
+                                 int              width,
+                                 int              y,
+                                 uint32_t         max,
+                                 uint32_t         factor);
+
+/**
+ * Average num_pixels pixels of rows a and b into out, rounding down.
+ */
+typedef void (*UfoAverageRowsFunc) (const uint16_t  *a,
+                                    const uint16_t  *b,
+                                    uint16_t        *out,
+                                    size_t           num_pixels);
+
+typedef struct _UfoThreadPool UfoThreadPool;
+typedef void (*UfoTaskFunc) (void *data, size_t index);
+
+/**
+ * Part of a frame payload that can be decoded independently. start and end
+ * are word offsets relative to the payload, off is the 4 channel mode offset
+ * at start. The remaining fields hold what was found when scanning the part.
+ */
+typedef struct {
+    size_t      start;
+    size_t      end;
+    size_t      off;
+    size_t      stop;       /**< Position of the footer or SIZE_MAX */
+    size_t      num_e0;     /**< Number of 0xe0 blocks after the last 0xc0 */
+    bool        has_c0;
+} UfoPayloadRange;
+
+/**
+ * Frame decoded ahead of time. start is the word offset of the frame in the
+ * raw data, advance the number of words consumed, which is 0 on error.
+ */
+typedef struct {
+    uint16_t       *pixels;
+    UfoDecoderMeta  meta;
+    size_t          start;
+    size_t          advance;
+    UfoDecoderStats stats;      /**< Timing of decoding the frame */
+} UfoFrameSlot;
+
+/**
+ * Frame buffer of the pool handed out by ufo_decoder_acquire_frame.
+ */
+typedef struct {
+    uint16_t       *pixels;
+    size_t          num_pixels;     /**< Allocated size of pixels */
+    bool            in_use;
+} UfoFrameBuffer;
+
+/**
+ * State of a stream fed with ufo_decoder_push_data. The data to decode is the
+ * carry buffer followed by the current chunk, pos is the word position in
+ * there. Only the carry buffer is owned by the decoder and holds what was
+ * left of earlier chunks.
+ */
+typedef struct {
+    uint32_t       *carry;
+    size_t          carry_bytes;
+    size_t          carry_size;     /**< Allocated size of carry in bytes */
+    const uint32_t *chunk;
+    size_t          chunk_bytes;
+    size_t          pos;
+} UfoStream;
 
 struct _UfoDecoder {
     int32_t     height;
     uint32_t    width;
     uint32_t   *raw;
-    size_t      num_bytes; 
-    uint32_t    current_pos;
+    size_t      num_bytes;
+    size_t      current_pos;
+
+    UfoDecodeBlocksV5Func       decode_blocks_v5;
+    UfoDecodeBlocksV5_4chFunc   decode_blocks_v5_4ch;
+    UfoDecodeBlocksV6Func       decode_blocks_v6;
+    UfoDecodeBlocksV6Func       decode_blocks_v6_11;
+    UfoFindMarkerFunc           find_marker;
+
+    UfoThreadPool      *pool;
+    UfoPayloadRange    *ranges;
+    size_t              payload_words;  /**< Payload size of the last frame */
+
+    UfoFrameSlot       *slots;
+    size_t              num_slots;
+    size_t              num_ready;      /**< Slots decoded by the last batch */
+    size_t              next_slot;      /**< Next slot to hand out */
+    size_t              frame_words;    /**< Distance between the last frames */
+
+    UfoFrameBuffer     *buffers;
+    size_t              num_buffers;
+
+    UfoStream           stream;
+
+    UfoDecoderStats     stats;
+    bool                timing;         /**< Whether stats include timing */
+
+    uint32_t            roi_x;
+    uint32_t            roi_y;
+    uint32_t            roi_width;      /**< 0 if whole frames are decoded */
+    uint32_t            roi_height;
+    size_t              roi_start;      /**< Payload position of the region in the last frame */
+};
+
+struct _UfoPipeline {
+    UfoDecoder     *decoder;
+    UfoStageType    stages[IPECAMERA_MAX_STAGES];
+    size_t          num_stages;
+    uint16_t        max;
+    unsigned        shift;          /**< Right shift of UFO_STAGE_TO_8_BIT */
+    uint8_t        *lut;            /**< Table of UFO_STAGE_TO_8_BIT used instead of shift */
+    uint16_t       *frame;          /**< Frame decoded by ufo_pipeline_get_next_frame */
+    size_t          frame_pixels;   /**< Allocated size of frame in pixels */
+    uint16_t       *scratch;        /**< Tile buffers of all bands and stages */
+    size_t          scratch_size;   /**< Allocated size of scratch in bytes */
+    size_t          scratch_rows;   /**< Rows of one tile buffer */
 };
 
+unsigned        ufo_get_num_cpus                (void);
+UfoThreadPool  *ufo_thread_pool_new             (unsigned        num_threads);
+void            ufo_thread_pool_free            (UfoThreadPool  *pool);
+unsigned        ufo_thread_pool_get_num_threads (UfoThreadPool  *pool);
+void            ufo_thread_pool_run             (UfoThreadPool  *pool,
+                                                 UfoTaskFunc     func,
+                                                 void           *data,
+                                                 size_t          num_tasks);
+
+/**
+ * Whether word is the first word of a frame header, of which only the first
+ * 28 bits are fixed, or of a footer.
+ */
+static inline bool
+ufo_is_marker (uint32_t word)
+{
+    return ((word & 0xFFFFFFF0) == 0x51111110) || (word == 0x0AAAAAAA);
+}
+
+/**
+ * Whether raw points to a frame header. Payload decoders stop there, because
+ * the frame they decode must have lost its end.
+ */
+static inline bool
+ufo_is_frame_header (const uint32_t *raw)
+{
+    return ((raw[0] & 0xFFFFFFF0) == 0x51111110) && (raw[1] == 0x52222222);
+}
+
+/**
+ * Whether a payload block whose last pixel is in last_row and last_column lies
+ * within a frame of num_rows rows of width pixels. Corrupt headers can point
+ * anywhere, blocks that do not fit are skipped.
+ */
+static inline bool
+ufo_block_fits (size_t last_row, size_t last_column, size_t width, size_t num_rows)
+{
+    return (last_row < num_rows) && (last_column < width);
+}
+
+/**
+ * Same for a dataformat v6 payload block, whose second half is placed at
+ * IPECAMERA_V6_SECOND_HALF.
+ */
+static inline bool
+ufo_block_fits_v6 (size_t row, size_t pixel, size_t width, size_t num_rows)
+{
+    const size_t second_half = IPECAMERA_V6_SECOND_HALF (width);
+
+    return ufo_block_fits (row + second_half / width, pixel + 7 * IPECAMERA_PIXELS_PER_CHANNEL + second_half % width,
+                           width, num_rows);
+}
+
+/**
+ * Unpack the four pixels of a dataformat v5 payload block in 4 channel mode,
+ * where raw points past the block header, to out with space between them.
+ */
+static inline void
+ufo_decode_pixels_v5_4ch (uint16_t *out, const uint32_t *raw, size_t space)
+{
+    out[0 * space] = 0xfff & (raw[5] >> 12);
+    out[1 * space] = 0xfff & (raw[4] >> 4);
+    out[2 * space] = ((0xf & raw[1]) << 8) | (raw[2] >> 24);
+    out[3 * space] = 0xfff & (raw[1] >> 16);
+}
+
+/**
+ * Decode one dataformat v5 payload block in 4 channel mode into a frame of
+ * num_rows rows of width pixels. Blocks with a 0xe0 magic carry no pixels but
+ * advance the channel offset, 0xc0 resets it.
+ */
+static inline void
+ufo_decode_block_v5_4ch (uint16_t *pixel_buffer, const uint32_t *raw, size_t *off, size_t width, size_t num_rows)
+{
+    const payload_header_v5 *header = (const payload_header_v5 *) raw;
+    const size_t index = header->row_number * width + header->pixel_number;
+
+    /* Skip header + one zero-filled words */
+    raw += 2;
 
+    if ((header->magic != 0xe0) && (header->magic != 0xc0)) {
+        if (!ufo_block_fits (header->row_number, header->pixel_number + (*off + 12) * IPECAMERA_PIXELS_PER_CHANNEL,
+                             width, num_rows))
+            return;
+
+        ufo_decode_pixels_v5_4ch (pixel_buffer + index + *off * IPECAMERA_PIXELS_PER_CHANNEL, raw,
+                                  4 * IPECAMERA_PIXELS_PER_CHANNEL);
+    }
+    else {
+        (*off)++;
+
+        if (header->magic == 0xc0)
+            *off = 0;
+    }
+}
+
+/**
+ * Fixed-point factor that maps 0 to max onto 0 to 255 with ufo_bayer_scale.
+ * Scaled values are never more than one above the exact quotient.
+ */
+static inline uint32_t
+ufo_bayer_factor (uint32_t max)
+{
+    return ((255u << 23) / max) + 1;
+}
+
+static inline uint8_t
+ufo_bayer_scale (uint32_t value, uint32_t max, uint32_t factor)
+{
+    return ((value < max ? value : max) * factor) >> 23;
+}
+
+/**
+ * Interpolate pixel x of row y bilinearly from its neighbours. The pattern
+ * starts with
+ *
+ *   R G
+ *   G B
+ *
+ * at (0, 0).
+ */
+static inline void
+ufo_convert_bayer_pixel (const uint16_t *row, uint8_t *out, int width, int x, int y, uint32_t max, uint32_t factor)
+{
+    const uint16_t *up = row - width;
+    const uint16_t *down = row + width;
+    const uint32_t c = row[x];
+    const uint32_t h2 = ((uint32_t) row[x - 1] + row[x + 1]) / 2;
+    const uint32_t v2 = ((uint32_t) up[x] + down[x]) / 2;
+    const uint32_t d4 = ((uint32_t) up[x - 1] + up[x + 1] + down[x - 1] + down[x + 1]) / 4;
+    const uint32_t x4 = ((uint32_t) row[x - 1] + row[x + 1] + up[x] + down[x]) / 4;
+    uint32_t r, g, b;
+
+    if ((y & 1) == 0) {
+        if ((x & 1) == 0) {
+            r = c; g = x4; b = d4;
+        }
+        else {
+            r = h2; g = c; b = v2;
+        }
+    }
+    else {
+        if ((x & 1) == 0) {
+            r = v2; g = c; b = h2;
+        }
+        else {
+            r = d4; g = x4; b = c;
+        }
+    }
+
+    out += 3 * x;
+    out[0] = ufo_bayer_scale (r, max, factor);
+    out[1] = ufo_bayer_scale (g, max, factor);
+    out[2] = ufo_bayer_scale (b, max, factor);
+}
+
+#ifdef HAVE_AVX2
+void   ufo_average_rows_avx2           (const uint16_t *a, const uint16_t *b, uint16_t *out, size_t num_pixels);
+void   ufo_convert_bayer_row_avx2      (const uint16_t *row, uint8_t *out, int width, int y, uint32_t max, uint32_t factor);
+size_t ufo_find_marker_avx2            (const uint32_t *raw, size_t num_words);
+const UfoKernels *ufo_get_kernels_avx2 (size_t width);
 #endif
 
+#ifdef HAVE_AVX512
+size_t ufo_find_marker_avx512          (const uint32_t *raw, size_t num_words);
+const UfoKernels *ufo_get_kernels_avx512 (size_t width);
+#endif
+
+#endif
@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "config.h"
+#include "ufodecode-private.h"
+
+struct _UfoThreadPool {
+    pthread_t          *threads;
+    unsigned            num_threads;
+    pthread_mutex_t     lock;
+    pthread_cond_t      work_cond;
+    pthread_cond_t      done_cond;
+    UfoTaskFunc         func;
+    void               *data;
+    size_t              num_tasks;
+    size_t              next_task;
+    size_t              num_done;
+    bool                quit;
+};
+
+/*
+ * Run tasks of the current job until none are left. Must be called with the
+ * lock held.
+ */
+static void
+run_tasks (UfoThreadPool *pool)
+{
+    while (pool->next_task < pool->num_tasks) {
+        const size_t index = pool->next_task++;
+        UfoTaskFunc func = pool->func;
+        void *data = pool->data;
+
+        pthread_mutex_unlock (&pool->lock);
+        func (data, index);
+        pthread_mutex_lock (&pool->lock);
+
+        if (++pool->num_done == pool->num_tasks)
+            pthread_cond_signal (&pool->done_cond);
+    }
+}
+
+static void *
+worker (void *data)
+{
+    UfoThreadPool *pool = (UfoThreadPool *) data;
+
+    pthread_mutex_lock (&pool->lock);
+
+    while (!pool->quit) {
+        run_tasks (pool);
+        pthread_cond_wait (&pool->work_cond, &pool->lock);
+    }
+
+    pthread_mutex_unlock (&pool->lock);
+    return NULL;
+}
+
+/**
+ * Number of online CPUs, at least one.
+ */
+unsigned
+ufo_get_num_cpus (void)
+{
+    const long n = sysconf (_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned) n : 1;
+}
+
+/**
+ * Create a pool that runs tasks on num_threads threads, including the one
+ * calling ufo_thread_pool_run.
+ */
+UfoThreadPool *
+ufo_thread_pool_new (unsigned num_threads)
+{
+    UfoThreadPool *pool = calloc (1, sizeof (UfoThreadPool));
+
+    if (pool == NULL)
+        return NULL;
+
+    pool->threads = calloc (num_threads, sizeof (pthread_t));
+
+    if (pool->threads == NULL) {
+        free (pool);
+        return NULL;
+    }
+
+    pthread_mutex_init (&pool->lock, NULL);
+    pthread_cond_init (&pool->work_cond, NULL);
+    pthread_cond_init (&pool->done_cond, NULL);
+
+    for (unsigned i = 0; i < num_threads - 1; i++) {
+        if (pthread_create (&pool->threads[i], NULL, worker, pool))
+            break;
+
+        pool->num_threads++;
+    }
+
+    return pool;
+}
+
+void
+ufo_thread_pool_free (UfoThreadPool *pool)
+{
+    if (pool == NULL)
+        return;
+
+    pthread_mutex_lock (&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast (&pool->work_cond);
+    pthread_mutex_unlock (&pool->lock);
+
+    for (unsigned i = 0; i < pool->num_threads; i++)
+        pthread_join (pool->threads[i], NULL);
+
+    pthread_cond_destroy (&pool->done_cond);
+    pthread_cond_destroy (&pool->work_cond);
+    pthread_mutex_destroy (&pool->lock);
+    free (pool->threads);
+    free (pool);
+}
+
+/**
+ * Total number of threads working on a job.
+ */
+unsigned
+ufo_thread_pool_get_num_threads (UfoThreadPool *pool)
+{
+    return pool->num_threads + 1;
+}
+
+/**
+ * Call func (data, i) for every i < num_tasks and return when all calls have
+ * finished. The calling thread works on the tasks as well.
+ */
+void
+ufo_thread_pool_run (UfoThreadPool *pool, UfoTaskFunc func, void *data, size_t num_tasks)
+{
+    pthread_mutex_lock (&pool->lock);
+
+    pool->func = func;
+    pool->data = data;
+    pool->num_tasks = num_tasks;
+    pool->next_task = 0;
+    pool->num_done = 0;
+
+    pthread_cond_broadcast (&pool->work_cond);
+    run_tasks (pool);
+
+    while (pool->num_done < pool->num_tasks)
+        pthread_cond_wait (&pool->done_cond, &pool->lock);
+
+    pthread_mutex_unlock (&pool->lock);
+}
@@ -1,19 +1,18 @@
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include "config.h"
 #include "ufodecode.h"
 #include "ufodecode-private.h"
-#include "config.h"
 
 #ifdef HAVE_SSE
 #include <xmmintrin.h>
 #endif
 
-#define IPECAMERA_NUM_ROWS              1088
-#define IPECAMERA_NUM_CHANNELS          16      /**< Number of channels per row */
-#define IPECAMERA_PIXELS_PER_CHANNEL    128     /**< Number of pixels per channel */
-
 #define IPECAMERA_MODE_16_CHAN_IO	0
 #define IPECAMERA_MODE_4_CHAN_IO	2
 
@@ -65,13 +64,6 @@ typedef struct {
     unsigned five_4 : 4;
 } header_v6_t;
 
-typedef struct {
-    unsigned pixel_number : 8;
-    unsigned row_number : 12;
-    unsigned pixel_size : 4;
-    unsigned magic : 8;
-} payload_header_v5;
-
 /**
  * Check if value matches expected input.
  */
@@ -104,11 +96,187 @@ typedef struct {
     }
 #endif
 
+static size_t
+ufo_find_marker (const uint32_t *raw, size_t num_words)
+{
+    for (size_t i = 0; i < num_words; i++) {
+        if (ufo_is_marker (raw[i]))
+            return i;
+    }
+
+    return num_words;
+}
+
+/*
+ * Monotonic time in nanoseconds if timing is enabled, otherwise 0 so that
+ * differences of it can be added to the statistics unconditionally.
+ */
+static inline uint64_t
+ufo_decoder_now (const UfoDecoder *decoder)
+{
+    struct timespec ts;
+
+    if (!decoder->timing)
+        return 0;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Count a frame taken from the stream that consumed advance words, which is 0
+ * for a corrupt one.
+ */
+static inline void
+ufo_decoder_count_frame (UfoDecoder *decoder, size_t advance)
+{
+    if (advance) {
+        decoder->stats.num_frames++;
+        decoder->stats.num_bytes += advance * 4;
+    }
+    else
+        decoder->stats.num_corrupt_frames++;
+}
+
+static inline void
+ufo_decoder_count_skipped (UfoDecoder *decoder, size_t num_resync, size_t num_fill)
+{
+    decoder->stats.num_resync_words += num_resync;
+    decoder->stats.num_fill_words += num_fill;
+    decoder->stats.num_bytes += (num_resync + num_fill) * 4;
+}
+
+/*
+ * Count the frame at start that consumed advance words of a stream that moved
+ * from from to to. Everything before the frame and, if it is corrupt, the
+ * frame itself was skipped to resync, everything after it is fill.
+ */
+static void
+ufo_decoder_count_span (UfoDecoder *decoder, size_t from, size_t start, size_t advance, size_t to)
+{
+    if (advance)
+        ufo_decoder_count_skipped (decoder, start - from, to - start - advance);
+    else
+        ufo_decoder_count_skipped (decoder, to - from, 0);
+
+    ufo_decoder_count_frame (decoder, advance);
+}
+
+static void
+ufo_decoder_set_kernels (UfoDecoder *decoder, const UfoKernels *kernels)
+{
+    decoder->decode_blocks_v5 = kernels->v5;
+    decoder->decode_blocks_v5_4ch = kernels->v5_4ch;
+    decoder->decode_blocks_v6 = kernels->v6;
+    decoder->decode_blocks_v6_11 = kernels->v6_11;
+}
+
+/**
+ * Pick the widest payload kernels the CPU supports, specialized for the width
+ * of the decoder if possible. The choice can be limited by setting
+ * UFODECODE_SIMD to "none", "avx2" or "avx512".
+ */
+static void
+ufo_decoder_select_kernels (UfoDecoder *decoder)
+{
+    const char *simd = getenv ("UFODECODE_SIMD");
+
+    decoder->decode_blocks_v5 = NULL;
+    decoder->decode_blocks_v5_4ch = NULL;
+    decoder->decode_blocks_v6 = NULL;
+    decoder->decode_blocks_v6_11 = NULL;
+    decoder->find_marker = ufo_find_marker;
+
+    if (simd != NULL && !strcmp (simd, "none"))
+        return;
+
+#if defined(HAVE_AVX512) && defined(__GNUC__)
+    if ((simd == NULL || !strcmp (simd, "avx512")) && __builtin_cpu_supports ("avx512f")) {
+        ufo_decoder_set_kernels (decoder, ufo_get_kernels_avx512 (decoder->width));
+        decoder->find_marker = ufo_find_marker_avx512;
+        return;
+    }
+#endif
+
+#if defined(HAVE_AVX2) && defined(__GNUC__)
+    if (__builtin_cpu_supports ("avx2")) {
+        ufo_decoder_set_kernels (decoder, ufo_get_kernels_avx2 (decoder->width));
+        decoder->find_marker = ufo_find_marker_avx2;
+        return;
+    }
+#endif
+}
+
+/*
+ * Whether the AVX2 kernels of the frame processing functions may be used,
+ * following the same rules as the payload kernels.
+ */
+static bool
+ufo_use_avx2 (void)
+{
+#if defined(HAVE_AVX2) && defined(__GNUC__)
+    const char *simd = getenv ("UFODECODE_SIMD");
+
+    return (simd == NULL || strcmp (simd, "none")) && __builtin_cpu_supports ("avx2");
+#else
+    return false;
+#endif
+}
+
+/**
+ * \brief Get the number of rows of decoded frames
+ *
+ * \param decoder An UfoDecoder instance
+ *
+ * \return The height passed to ufo_decoder_new or, if it was not positive, the
+ * number of rows a payload block can address. Rows beyond it are dropped.
+ */
+size_t
+ufo_decoder_get_num_rows (const UfoDecoder *decoder)
+{
+    return decoder->height > 0 ? (size_t) decoder->height : IPECAMERA_MAX_ROWS;
+}
+
+/*
+ * Number of pixels of a decoded frame. Payload blocks that would write
+ * outside of it are skipped by the decoders, see ufo_block_fits.
+ */
+static size_t
+ufo_decoder_get_num_pixels (const UfoDecoder *decoder)
+{
+    const size_t num_rows = ufo_decoder_get_num_rows (decoder);
+
+    if (decoder->roi_width > 0)
+        return (size_t) decoder->roi_width * decoder->roi_height;
+
+    return decoder->width * num_rows;
+}
+
+/*
+ * Allocate a frame as large as ufo_decoder_get_num_pixels. Frames are page
+ * aligned, so that kernels can use aligned stores. They are released with
+ * free like any other memory.
+ */
+static uint16_t *
+ufo_decoder_alloc_frame (const UfoDecoder *decoder)
+{
+    void *pixels;
+
+    if (posix_memalign (&pixels, IPECAMERA_FRAME_ALIGNMENT, ufo_decoder_get_num_pixels (decoder) * sizeof (uint16_t)))
+        return NULL;
+
+    return (uint16_t *) pixels;
+}
+
 /**
  * \brief Setup a new decoder instance
  *
  * \param height Number of rows that are expected in the data stream. Set this
- *      smaller 0 to let the decoder figure out the number of rows.
+ *      smaller 0 to let the decoder figure out the number of rows. Frame
+ *      buffers passed to the decoder must hold width times height pixels, or
+ *      width times 4096 if height is not positive. Payload blocks outside of
+ *      that are dropped.
+ * \param width Number of pixels per row, a multiple of 128 and at least 2048.
  * \param raw The data stream from the camera or NULL if set later with
  * ufo_decoder_set_raw_data.
  * \param num_bytes Size of the data stream buffer in bytes
@@ -119,7 +287,8 @@ typedef struct {
 UfoDecoder *
 ufo_decoder_new (int32_t height, uint32_t width, uint32_t *raw, size_t num_bytes)
 {
-    if (width % IPECAMERA_PIXELS_PER_CHANNEL)
+    /* Payload blocks address all channels of a row */
+    if (width % IPECAMERA_PIXELS_PER_CHANNEL || width < IPECAMERA_NUM_CHANNELS * IPECAMERA_PIXELS_PER_CHANNEL)
         return NULL;
 
     UfoDecoder *decoder = malloc (sizeof(UfoDecoder));
@@ -129,10 +298,38 @@ ufo_decoder_new (int32_t height, uint32_t width, uint32_t *raw, size_t num_bytes
 
     decoder->width = width;
     decoder->height = height;
+    decoder->pool = NULL;
+    decoder->ranges = NULL;
+    decoder->payload_words = 0;
+    decoder->slots = NULL;
+    decoder->num_slots = 0;
+    decoder->frame_words = 0;
+    decoder->buffers = NULL;
+    decoder->num_buffers = 0;
+    memset (&decoder->stream, 0, sizeof (UfoStream));
+    memset (&decoder->stats, 0, sizeof (UfoDecoderStats));
+    decoder->timing = false;
+    decoder->roi_x = 0;
+    decoder->roi_y = 0;
+    decoder->roi_width = 0;
+    decoder->roi_height = 0;
+    decoder->roi_start = 0;
+    ufo_decoder_select_kernels (decoder);
     ufo_decoder_set_raw_data (decoder, raw, num_bytes);
     return decoder;
 }
 
+static void
+ufo_decoder_free_slots (UfoDecoder *decoder)
+{
+    for (size_t i = 0; i < decoder->num_slots; i++)
+        free (decoder->slots[i].pixels);
+
+    free (decoder->slots);
+    decoder->slots = NULL;
+    decoder->num_slots = 0;
+}
+
 /**
  * \brief Release decoder instance
  *
@@ -141,517 +338,3237 @@ ufo_decoder_new (int32_t height, uint32_t width, uint32_t *raw, size_t num_bytes
 void
 ufo_decoder_free (UfoDecoder *decoder)
 {
+    ufo_decoder_free_slots (decoder);
+
+    for (size_t i = 0; i < decoder->num_buffers; i++)
+        free (decoder->buffers[i].pixels);
+
+    free (decoder->buffers);
+    ufo_thread_pool_free (decoder->pool);
+    free (decoder->ranges);
+    free (decoder->stream.carry);
     free (decoder);
 }
 
 /**
- * \brief Set raw data stream
+ * \brief Set number of threads used to decode a frame
+ *
+ * The payload of a frame is split into parts that are decoded in parallel.
+ * Each frame is still decoded completely before the call returns. Note that
+ * for corrupt frames with blocks overlapping each other it is undefined which
+ * of them ends up in the output.
  *
  * \param decoder An UfoDecoder instance
- * \param raw Raw data stream
- * \param num_bytes Size of data stream buffer in bytes
+ * \param num_threads Number of threads. 1 disables threading, which is the
+ * default, 0 uses one thread per CPU.
+ *
+ * \return 0 in case of no error, ENOMEM if the threads could not be set up.
  */
-void
-ufo_decoder_set_raw_data (UfoDecoder *decoder, uint32_t *raw, size_t num_bytes)
+int
+ufo_decoder_set_num_threads (UfoDecoder *decoder, uint32_t num_threads)
 {
-    decoder->raw = raw;
-    decoder->num_bytes = num_bytes;
-    decoder->current_pos = 0;
-}
+    if (num_threads == 0)
+        num_threads = ufo_get_num_cpus ();
 
-static size_t
-ufo_decode_frame_channels_v5 (UfoDecoder *decoder, uint16_t *pixel_buffer, uint32_t *raw, size_t num_bytes, size_t num_rows, uint8_t output_mode)
-{
-    payload_header_v5 *header;
-    size_t base = 0, index = 0;
+    ufo_thread_pool_free (decoder->pool);
+    free (decoder->ranges);
+    decoder->pool = NULL;
+    decoder->ranges = NULL;
 
-    if (output_mode == IPECAMERA_MODE_4_CHAN_IO) {
-        size_t off = 0;
+    if (num_threads == 1)
+        return 0;
 
-        while (raw[base] != 0xAAAAAAA) {
-            header = (payload_header_v5 *) &raw[base];
-            index = header->row_number * IPECAMERA_WIDTH + header->pixel_number;
+    decoder->pool = ufo_thread_pool_new (num_threads);
+    decoder->ranges = malloc (num_threads * sizeof (UfoPayloadRange));
 
-            /* Skip header + one zero-filled words */
-            base += 2;
+    if (decoder->pool == NULL || decoder->ranges == NULL) {
+        ufo_thread_pool_free (decoder->pool);
+        free (decoder->ranges);
+        decoder->pool = NULL;
+        decoder->ranges = NULL;
+        return ENOMEM;
+    }
 
-            if ((header->magic != 0xe0) && (header->magic != 0xc0)) {
-                pixel_buffer[index +  (0+off)*IPECAMERA_PIXELS_PER_CHANNEL] = 0xfff & (raw[base+5] >> 12);
-                pixel_buffer[index +  (4+off)*IPECAMERA_PIXELS_PER_CHANNEL] = 0xfff & (raw[base+4] >> 4);
-                pixel_buffer[index +  (8+off)*IPECAMERA_PIXELS_PER_CHANNEL] = ((0xf & raw[base+1]) << 8) | (raw[base+2] >> 24);
-                pixel_buffer[index + (12+off)*IPECAMERA_PIXELS_PER_CHANNEL] = 0xfff & (raw[base+1] >> 16);
-            }
-            else {
-                off++;
+    return 0;
+}
 
-                if (header->magic == 0xc0)
-                    off = 0;
-            }
+/**
+ * \brief Set number of frames decoded at once
+ *
+ * ufo_decoder_get_next_frame_buffer locates this many frames ahead of the
+ * current position and decodes them in parallel with the threads set up by
+ * ufo_decoder_set_num_threads. Each frame gets its own buffer owned by the
+ * decoder.
+ *
+ * \param decoder An UfoDecoder instance
+ * \param num_frames Number of frames. 0 uses one frame per decoding thread.
+ *
+ * \return 0 in case of no error, ENOMEM if the frame buffers could not be
+ * allocated.
+ */
+int
+ufo_decoder_set_frames_ahead (UfoDecoder *decoder, uint32_t num_frames)
+{
+    if (num_frames == 0)
+        num_frames = decoder->pool != NULL ? ufo_thread_pool_get_num_threads (decoder->pool) : 1;
 
-            base += 6;
-        }
-    }
-    else {
-        while (raw[base] != 0xAAAAAAA) {
-            header = (payload_header_v5 *) &raw[base];
-            index = header->row_number * IPECAMERA_WIDTH + header->pixel_number;
+    ufo_decoder_free_slots (decoder);
+    decoder->num_ready = 0;
+    decoder->next_slot = 0;
+    decoder->slots = calloc (num_frames, sizeof (UfoFrameSlot));
 
-            /* Skip header + two zero-filled words */
-            base += 2;
+    if (decoder->slots == NULL)
+        return ENOMEM;
 
-            if (header->magic != 0xc0) {
-                pixel_buffer[index + 15*IPECAMERA_PIXELS_PER_CHANNEL] = 0x3ff & (raw[base] >> 20);
-                pixel_buffer[index + 13*IPECAMERA_PIXELS_PER_CHANNEL] = 0x3ff & (raw[base] >> 8);
-                pixel_buffer[index + 14*IPECAMERA_PIXELS_PER_CHANNEL] = 0x3ff & (((0xff & raw[base]) << 4) | (raw[base+1] >> 28));
-                pixel_buffer[index + 12*IPECAMERA_PIXELS_PER_CHANNEL] = 0x3ff & (raw[base+1] >> 16);
-                pixel_buffer[index + 10*IPECAMERA_PIXELS_PER_CHANNEL] = 0x3ff & (raw[base+1] >> 4);
-                pixel_buffer[index +  8*IPECAMERA_PIXELS_PER_CHANNEL] = ((0x3 & raw[base+1]) << 8) | (raw[base+2] >> 24);
-                pixel_buffer[index + 11*IPECAMERA_PIXELS_PER_CHANNEL] = 0x3ff & (raw[base+2] >> 12);
-                pixel_buffer[index +  7*IPECAMERA_PIXELS_PER_CHANNEL] = 0x3ff & raw[base+2];
-                pixel_buffer[index +  9*IPECAMERA_PIXELS_PER_CHANNEL] = 0x3ff & (raw[base+3] >> 20);
-                pixel_buffer[index +  6*IPECAMERA_PIXELS_PER_CHANNEL] = 0x3ff & (raw[base+3] >> 8);
-                pixel_buffer[index +  5*IPECAMERA_PIXELS_PER_CHANNEL] = 0x3ff & (((0xff & raw[base+3]) << 4) | (raw[base+4] >> 28));
-                pixel_buffer[index +  2*IPECAMERA_PIXELS_PER_CHANNEL] = 0x3ff & (raw[base+4] >> 16);
-                pixel_buffer[index +  4*IPECAMERA_PIXELS_PER_CHANNEL] = 0x3ff & (raw[base+4] >> 4);
-                pixel_buffer[index +  3*IPECAMERA_PIXELS_PER_CHANNEL] = ((0x3 & raw[base+4]) << 8) | (raw[base+5] >> 24);
-                pixel_buffer[index +  0*IPECAMERA_PIXELS_PER_CHANNEL] = 0x3ff & (raw[base+5] >> 12);
-                pixel_buffer[index +  1*IPECAMERA_PIXELS_PER_CHANNEL] = 0x3ff & raw[base+5];
-            }
+    for (decoder->num_slots = 0; decoder->num_slots < num_frames; decoder->num_slots++) {
+        uint16_t *pixels = ufo_decoder_alloc_frame (decoder);
 
-            base += 6;
+        if (pixels == NULL) {
+            ufo_decoder_free_slots (decoder);
+            return ENOMEM;
         }
+
+        decoder->slots[decoder->num_slots].pixels = pixels;
     }
 
-    return base;
+    return 0;
 }
 
-static size_t
-ufo_decode_frame_channels_v6 (UfoDecoder *decoder, uint16_t *pixel_buffer, uint32_t *raw, size_t num_bytes, size_t num_rows, uint16_t start_offset)
+/*
+ * Append num_buffers unused buffers to the pool.
+ */
+static int
+ufo_decoder_grow_buffers (UfoDecoder *decoder, size_t num_buffers)
 {
-    size_t base = 0;
-    size_t index = 0;
-    const size_t space = IPECAMERA_PIXELS_PER_CHANNEL;
+    UfoFrameBuffer *buffers = realloc (decoder->buffers, (decoder->num_buffers + num_buffers) * sizeof (UfoFrameBuffer));
 
-#ifdef HAVE_SSE
-    const __m64 mask_fff = _mm_set_pi32 (0xfff, 0xfff);
-    __m64 mm_r;
-#endif
+    if (buffers == NULL)
+        return ENOMEM;
 
-    while ((raw[base] != 0xAAAAAAA) && ((num_bytes - base * 4) >= 32)) {
-        const size_t row_number = (raw[base] & 0xfff) - start_offset;
-        const size_t pixel_number = (raw[base + 1] >> 16) & 0xfff;
+    decoder->buffers = buffers;
 
-        base += 2;
-        index = row_number * IPECAMERA_WIDTH + pixel_number;
+    for (size_t i = 0; i < num_buffers; i++) {
+        UfoFrameBuffer *buffer = &buffers[decoder->num_buffers];
 
-#ifdef HAVE_SSE
-        const __m64 src1 = _mm_set_pi32 (raw[base], raw[base + 3]);
-        const __m64 src2 = _mm_set_pi32 (raw[base + 1], raw[base + 4]);
-        const __m64 src3 = _mm_set_pi32 (raw[base + 2], raw[base + 5]);
+        buffer->pixels = ufo_decoder_alloc_frame (decoder);
+        buffer->num_pixels = ufo_decoder_get_num_pixels (decoder);
+        buffer->in_use = false;
 
-#define store(i) \
-        pixel_buffer[index + i * space] = ((uint32_t *) &mm_r)[1]; \
-        pixel_buffer[index + IPECAMERA_WIDTH + i * space] = ((uint32_t *) &mm_r)[0];
+        if (buffer->pixels == NULL)
+            return ENOMEM;
+
+        decoder->num_buffers++;
+    }
 
-        mm_r = _mm_srli_pi32 (src1, 20);
-        store(0);
+    return 0;
+}
 
-        mm_r = _mm_and_si64 (_mm_srli_pi32 (src1, 8), mask_fff);
-        store(1);
+/**
+ * \brief Preallocate frame buffers
+ *
+ * Buffers handed out by ufo_decoder_acquire_frame come from a pool owned by
+ * the decoder. Filling the pool up front keeps the decoding loop free of
+ * allocations as long as no more frames than that are held at once.
+ *
+ * \param decoder An UfoDecoder instance
+ * \param num_buffers Number of buffers the pool holds at least
+ *
+ * \return 0 in case of no error, ENOMEM if the buffers could not be
+ * allocated.
+ */
+int
+ufo_decoder_set_num_buffers (UfoDecoder *decoder, uint32_t num_buffers)
+{
+    if (num_buffers <= decoder->num_buffers)
+        return 0;
 
-        mm_r = _mm_or_si64 (_mm_and_si64 (_mm_slli_pi32 (src1, 4), mask_fff), _mm_srli_pi32 (src2, 28));
-        store(2);
+    return ufo_decoder_grow_buffers (decoder, num_buffers - decoder->num_buffers);
+}
 
-        mm_r = _mm_and_si64 (_mm_srli_pi32 (src2, 16), mask_fff);
-        store(3);
+/**
+ * \brief Take a frame buffer from the pool
+ *
+ * The buffer is page aligned and large enough for the frames the decoder
+ * produces, which is the region of interest if one is set. The pool grows if
+ * all buffers are in use. Buffers of the pool are released by ufo_decoder_free
+ * and must not be passed to free.
+ *
+ * \param decoder An UfoDecoder instance
+ *
+ * \return A frame buffer that can be passed to ufo_decoder_get_next_frame and
+ * its siblings or NULL if no memory could be allocated.
+ */
+uint16_t *
+ufo_decoder_acquire_frame (UfoDecoder *decoder)
+{
+    const size_t num_pixels = ufo_decoder_get_num_pixels (decoder);
+    UfoFrameBuffer *buffer = NULL;
 
-        mm_r = _mm_and_si64 (_mm_srli_pi32 (src2, 4), mask_fff);
-        store(4);
+    for (size_t i = 0; i < decoder->num_buffers; i++) {
+        if (!decoder->buffers[i].in_use) {
+            buffer = &decoder->buffers[i];
+            break;
+        }
+    }
 
-        mm_r = _mm_or_si64 (_mm_and_si64 (_mm_slli_pi32 (src2, 8), mask_fff), _mm_srli_pi32 (src3, 24));
-        store(5);
+    if (buffer == NULL) {
+        if (ufo_decoder_grow_buffers (decoder, 1))
+            return NULL;
 
-        mm_r = _mm_and_si64 (_mm_srli_pi32 (src3, 12), mask_fff);
-        store(6);
+        buffer = &decoder->buffers[decoder->num_buffers - 1];
+    }
 
-        mm_r = _mm_and_si64 (src3, mask_fff);
-        store(7);
+    /* The region of interest may have grown since the buffer was allocated */
+    if (buffer->num_pixels < num_pixels) {
+        free (buffer->pixels);
+        buffer->pixels = ufo_decoder_alloc_frame (decoder);
+        buffer->num_pixels = buffer->pixels != NULL ? num_pixels : 0;
 
-#undef store
-#else
-        pixel_buffer[index + 0 * space] = (raw[base] >> 20);
-        pixel_buffer[index + 1 * space] = (raw[base] >> 8) & 0xfff;
-        pixel_buffer[index + 2 * space] = ((raw[base] << 4) & 0xfff) | (raw[base + 1] >> 28);
-        pixel_buffer[index + 3 * space] = (raw[base + 1] >> 16) & 0xfff;
-        pixel_buffer[index + 4 * space] = (raw[base + 1] >> 4) & 0xfff;
-        pixel_buffer[index + 5 * space] = ((raw[base + 1] << 8) & 0xfff) | (raw[base + 2] >> 24);
-        pixel_buffer[index + 6 * space] = (raw[base + 2] >> 12) & 0xfff;
-        pixel_buffer[index + 7 * space] = raw[base + 2] & 0xfff;
-
-        index += 8 * space;
-        pixel_buffer[index + 0 * space] = (raw[base + 3] >> 20);
-        pixel_buffer[index + 1 * space] = (raw[base + 3] >> 8) & 0xfff;
-        pixel_buffer[index + 2 * space] = ((raw[base + 3] << 4) & 0xfff) | (raw[base + 4] >> 28);
-        pixel_buffer[index + 3 * space] = (raw[base + 4] >> 16) & 0xfff;
-        pixel_buffer[index + 4 * space] = (raw[base + 4] >> 4) & 0xfff;
-        pixel_buffer[index + 5 * space] = ((raw[base + 4] << 8) & 0xfff) | (raw[base + 5] >> 24);
-        pixel_buffer[index + 6 * space] = (raw[base + 5] >> 12) & 0xfff;
-        pixel_buffer[index + 7 * space] = (raw[base + 5] & 0xfff);
-#endif
+        if (buffer->pixels == NULL)
+            return NULL;
+    }
 
-        base += 6;
+    buffer->in_use = true;
+    return buffer->pixels;
+}
 
-        if ((raw[base] & 0xFF000000) == 0xC0000000) {
-            base += 8;
+/**
+ * \brief Return a frame buffer to the pool
+ *
+ * \param decoder An UfoDecoder instance
+ * \param pixels Buffer returned by ufo_decoder_acquire_frame
+ *
+ * \return 0 in case of no error, EINVAL if pixels is not a buffer of the pool
+ * that is in use.
+ */
+int
+ufo_decoder_release_frame (UfoDecoder *decoder, uint16_t *pixels)
+{
+    for (size_t i = 0; i < decoder->num_buffers; i++) {
+        if ((decoder->buffers[i].pixels == pixels) && decoder->buffers[i].in_use) {
+            decoder->buffers[i].in_use = false;
+            return 0;
         }
     }
 
-    return base;
+    return EINVAL;
 }
 
 /**
- * \brief Deinterlace by interpolating between two rows
+ * \brief Set raw data stream
  *
- * \param in Input frame
- * \param out Destination of interpolated frame
- * \param width Width of frame in pixels
- * \param height Height of frame in pixels
+ * \param decoder An UfoDecoder instance
+ * \param raw Raw data stream
+ * \param num_bytes Size of data stream buffer in bytes
  */
 void
-ufo_deinterlace_interpolate (const uint16_t *in, uint16_t *out, int width, int height)
+ufo_decoder_set_raw_data (UfoDecoder *decoder, uint32_t *raw, size_t num_bytes)
 {
-    const size_t row_size_bytes = width * sizeof(uint16_t);
-
-    for (int row = 0; row < height; row++) {
-        /* Copy one line */
-        memcpy (out, in + row*width, row_size_bytes);
-        out += width;
+    decoder->raw = raw;
+    decoder->num_bytes = num_bytes;
+    decoder->current_pos = 0;
+    decoder->num_ready = 0;
+    decoder->next_slot = 0;
+}
 
-        /* Interpolate between source row and row+1 */
-        for (int x = 0; x < width; x++)
-            out[x] = (int) (0.5 * in[row*width + x] + 0.5 * in[(row+1)*width + x]);
+/**
+ * \brief Get position in the raw data stream
+ *
+ * \param decoder An UfoDecoder instance
+ *
+ * \return Number of bytes of the raw data stream that have been processed by
+ * ufo_decoder_get_next_frame or ufo_decoder_get_next_frame_buffer.
+ */
+size_t
+ufo_decoder_get_position (UfoDecoder *decoder)
+{
+    return decoder->current_pos * 4;
+}
 
-        out += width;
-    }
+/**
+ * \brief Enable timing of the decoding steps
+ *
+ * Timing is off by default, because it costs a clock read before and after
+ * each step. Counting frames and words is always on.
+ *
+ * \param decoder An UfoDecoder instance
+ * \param enable Non-zero to accumulate header_ns, payload_ns and scan_ns in
+ * the statistics
+ */
+void
+ufo_decoder_set_timing (UfoDecoder *decoder, int enable)
+{
+    decoder->timing = enable != 0;
+}
 
-    /* Copy last row */
-    memcpy (out, in + width * (height - 1), row_size_bytes);
+/**
+ * \brief Get decoder statistics
+ *
+ * The statistics accumulate over all data decoded since the decoder was
+ * created or ufo_decoder_reset_stats was called. Frames decoded ahead of time
+ * are counted once they are verified to be in the stream, not when they are
+ * returned.
+ *
+ * \param decoder An UfoDecoder instance
+ * \param stats Location for the statistics
+ */
+void
+ufo_decoder_get_stats (UfoDecoder *decoder, UfoDecoderStats *stats)
+{
+    *stats = decoder->stats;
 }
 
 /**
- * \brief Deinterlace by "weaving" the rows of two frames
+ * \brief Reset decoder statistics to zero
  *
- * \param in1 First frame
- * \param in2 Second frame
- * \param out Destination of weaved frame
- * \param width Width of frame in pixels
- * \param height Height of frame in pixels
+ * \param decoder An UfoDecoder instance
  */
 void
-ufo_deinterlace_weave (const uint16_t *in1, const uint16_t *in2, uint16_t *out, int width, int height)
+ufo_decoder_reset_stats (UfoDecoder *decoder)
 {
-    const size_t row_size_bytes = width * sizeof(uint16_t);
-    for (int row = 0; row < height; row++) {
-        memcpy (out, in1 + row*width, row_size_bytes);
-        out += width;
-        memcpy (out, in2 + row*width, row_size_bytes);
-        out += width;
-    }
+    memset (&decoder->stats, 0, sizeof (UfoDecoderStats));
 }
 
 /**
- * \brief Decodes frame
+ * \brief Decode only a region of interest
  *
- * This function tries to decode the supplied data
+ * Frames are decoded into a compact buffer of width x height pixels holding
+ * only the given region. Payload blocks without pixels in the region are
+ * skipped after reading their header. The SIMD kernels are not used, so this
+ * is only faster than decoding whole frames for regions that cover a small
+ * part of the rows. Frame buffers set up with ufo_decoder_set_frames_ahead
+ * are reallocated to the new size.
  *
  * \param decoder An UfoDecoder instance
- * \param raw Raw data stream
- * \param num_bytes Size of data stream buffer in bytes
- * \param pixels If pointer with NULL content is passed, a new buffer is
- * allocated otherwise, this user-supplied buffer is used.
- * \param frame_number Frame number as reported in the header
- * \param time_stamp Time stamp of the frame as reported in the header
+ * \param x First column of the region
+ * \param y First row of the region
+ * \param width Number of columns of the region. 0 decodes whole frames again.
+ * \param height Number of rows of the region
  *
- * \return number of decoded bytes or 0 in case of error
+ * \return 0 in case of no error, EINVAL if the region does not fit into a
+ * frame and ENOMEM if frame buffers could not be reallocated.
  */
-size_t
-ufo_decoder_decode_frame (UfoDecoder *decoder, uint32_t *raw, size_t num_bytes, uint16_t *pixels, UfoDecoderMeta *meta)
+int
+ufo_decoder_set_roi (UfoDecoder *decoder, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
 {
-    int err = 0;
-    size_t pos = 0;
-    size_t advance = 0;
-    const size_t num_words = num_bytes / 4;
-    size_t rows_per_frame = decoder->height;
-    const pre_header_t *pre_header;
-
-    if ((pixels == NULL) || (num_words < 16))
-        return 0;
+    const size_t num_rows = ufo_decoder_get_num_rows (decoder);
 
-    pre_header = (pre_header_t *) raw;
+    if ((width > 0) && ((height == 0) || ((size_t) x + width > decoder->width) || ((size_t) y + height > num_rows)))
+        return EINVAL;
 
-    CHECK_VALUE (pre_header->five, 0x5);
-    CHECK_VALUE (pre_header->ones, 0x111111);
+    decoder->roi_x = x;
+    decoder->roi_y = y;
+    decoder->roi_width = width;
+    decoder->roi_height = width > 0 ? height : 0;
+    decoder->roi_start = 0;
 
-    const int header_version = pre_header->version + 5;    /* it starts with 0 */
-    int dataformat_version = 5;      /* will overwrite for header_version >= 6 */
+    if (decoder->slots != NULL)
+        return ufo_decoder_set_frames_ahead (decoder, decoder->num_slots);
+
+    return 0;
+}
+
+/*
+ * Unpack the sixteen pixels of a dataformat v5 payload block in 16 channel
+ * mode, where raw points past the block header, to out with space between
+ * them.
+ */
+static inline void
+ufo_decode_pixels_v5 (uint16_t *out, const uint32_t *raw, size_t space)
+{
+    out[15 * space] = 0x3ff & (raw[0] >> 20);
+    out[13 * space] = 0x3ff & (raw[0] >> 8);
+    out[14 * space] = 0x3ff & (((0xff & raw[0]) << 4) | (raw[1] >> 28));
+    out[12 * space] = 0x3ff & (raw[1] >> 16);
+    out[10 * space] = 0x3ff & (raw[1] >> 4);
+    out[ 8 * space] = ((0x3 & raw[1]) << 8) | (raw[2] >> 24);
+    out[11 * space] = 0x3ff & (raw[2] >> 12);
+    out[ 7 * space] = 0x3ff & raw[2];
+    out[ 9 * space] = 0x3ff & (raw[3] >> 20);
+    out[ 6 * space] = 0x3ff & (raw[3] >> 8);
+    out[ 5 * space] = 0x3ff & (((0xff & raw[3]) << 4) | (raw[4] >> 28));
+    out[ 2 * space] = 0x3ff & (raw[4] >> 16);
+    out[ 4 * space] = 0x3ff & (raw[4] >> 4);
+    out[ 3 * space] = ((0x3 & raw[4]) << 8) | (raw[5] >> 24);
+    out[ 0 * space] = 0x3ff & (raw[5] >> 12);
+    out[ 1 * space] = 0x3ff & raw[5];
+}
+
+/*
+ * Whether any of the num_channels pixels in row that start at column and are
+ * stride columns apart lies within the region of interest.
+ */
+static inline bool
+ufo_roi_contains (const UfoDecoder *decoder, size_t row, size_t column, size_t num_channels, size_t stride)
+{
+    const size_t first = column >= decoder->roi_x ? 0 : (decoder->roi_x - column + stride - 1) / stride;
+
+    return ((row - decoder->roi_y) < decoder->roi_height) &&
+           (first < num_channels) && ((column + first * stride - decoder->roi_x) < decoder->roi_width);
+}
+
+/*
+ * Store those of the num_channels values that lie within the region of
+ * interest, see ufo_roi_contains, into the compact frame at pixels.
+ */
+static inline void
+ufo_roi_store (const UfoDecoder *decoder, uint16_t *pixels, size_t row, size_t column, const uint16_t *values,
+               size_t num_channels, size_t stride)
+{
+    if ((row - decoder->roi_y) >= decoder->roi_height)
+        return;
+
+    pixels += (row - decoder->roi_y) * decoder->roi_width;
+
+    for (size_t i = 0; i < num_channels; i++) {
+        const size_t x = column + i * stride - decoder->roi_x;
+
+        if (x < decoder->roi_width)
+            pixels[x] = values[i];
+    }
+}
+
+/*
+ * Decode the dataformat v5 payload blocks that contain pixels of the region of
+ * interest. All other blocks are skipped after reading their header. If first
+ * is not NULL, the walk ends at the first block below the region and the
+ * position of the first block within the region is stored in first.
+ */
+static size_t
+ufo_decode_frame_channels_v5_roi (UfoDecoder *decoder, uint16_t *pixels, const uint32_t *raw, size_t num_bytes,
+                                  uint8_t output_mode, size_t *off, size_t *first)
+{
+    const size_t space = IPECAMERA_PIXELS_PER_CHANNEL;
+    const size_t end_row = decoder->roi_y + decoder->roi_height;
+    uint16_t values[IPECAMERA_NUM_CHANNELS];
+    size_t base = 0;
+
+    while (((base * 4 + 32) <= num_bytes) && (raw[base] != 0xAAAAAAA) && !ufo_is_frame_header (raw + base)) {
+        const payload_header_v5 *header = (const payload_header_v5 *) &raw[base];
+        const size_t row = header->row_number;
+
+        if ((first != NULL) && (header->magic != 0xe0) && (header->magic != 0xc0)) {
+            if (row >= end_row)
+                break;
+
+            if ((*first == SIZE_MAX) && (row >= decoder->roi_y))
+                *first = base;
+        }
+
+        if (output_mode == IPECAMERA_MODE_4_CHAN_IO) {
+            const size_t column = header->pixel_number + *off * space;
+
+            if ((header->magic == 0xe0) || (header->magic == 0xc0)) {
+                (*off)++;
+
+                if (header->magic == 0xc0)
+                    *off = 0;
+            }
+            else if (ufo_roi_contains (decoder, row, column, 4, 4 * space)) {
+                ufo_decode_pixels_v5_4ch (values, raw + base + 2, 1);
+                ufo_roi_store (decoder, pixels, row, column, values, 4, 4 * space);
+            }
+        }
+        else if ((header->magic != 0xc0) &&
+                 ufo_roi_contains (decoder, row, header->pixel_number, IPECAMERA_NUM_CHANNELS, space)) {
+            ufo_decode_pixels_v5 (values, raw + base + 2, 1);
+            ufo_roi_store (decoder, pixels, row, header->pixel_number, values, IPECAMERA_NUM_CHANNELS, space);
+        }
+
+        base += 8;
+    }
+
+    return base;
+}
+
+/*
+ * off is the channel offset of the 4 channel mode at the start of raw, which
+ * is only non-zero when decoding a part of the payload. It is updated to the
+ * offset at the end.
+ */
+static size_t
+ufo_decode_frame_channels_v5 (UfoDecoder *decoder, uint16_t *pixel_buffer, uint32_t *raw, size_t num_bytes, size_t num_rows, uint8_t output_mode, size_t *off)
+{
+    payload_header_v5 *header;
+    size_t base = 0, index = 0;
+
+    if (decoder->roi_width > 0)
+        return ufo_decode_frame_channels_v5_roi (decoder, pixel_buffer, raw, num_bytes, output_mode, off, NULL);
+
+    if (output_mode == IPECAMERA_MODE_4_CHAN_IO) {
+        while (((base * 4 + 32) <= num_bytes) && (raw[base] != 0xAAAAAAA) && !ufo_is_frame_header (raw + base)) {
+            if (decoder->decode_blocks_v5_4ch != NULL) {
+                const size_t advance = decoder->decode_blocks_v5_4ch (pixel_buffer, raw + base, (num_bytes - base * 4) / 32, off,
+                                                                      decoder->width, num_rows);
+
+                if (advance > 0) {
+                    base += advance;
+                    continue;
+                }
+            }
+
+            ufo_decode_block_v5_4ch (pixel_buffer, raw + base, off, decoder->width, num_rows);
+            base += 8;
+        }
+    }
+    else {
+        while (((base * 4 + 32) <= num_bytes) && (raw[base] != 0xAAAAAAA) && !ufo_is_frame_header (raw + base)) {
+            if (decoder->decode_blocks_v5 != NULL) {
+                const size_t advance = decoder->decode_blocks_v5 (pixel_buffer, raw + base, (num_bytes - base * 4) / 32,
+                                                                  decoder->width, num_rows);
+
+                if (advance > 0) {
+                    base += advance;
+                    continue;
+                }
+            }
+
+            header = (payload_header_v5 *) &raw[base];
+            index = header->row_number * decoder->width + header->pixel_number;
+
+            /* Skip header + two zero-filled words */
+            base += 2;
+
+            if ((header->magic != 0xc0) &&
+                ufo_block_fits (header->row_number, header->pixel_number + 15 * IPECAMERA_PIXELS_PER_CHANNEL,
+                                decoder->width, num_rows))
+                ufo_decode_pixels_v5 (pixel_buffer + index, raw + base, IPECAMERA_PIXELS_PER_CHANNEL);
+
+            base += 6;
+        }
+    }
+
+    return base;
+}
+
+/*
+ * In 11-bit ADC mode the eight pixels in each half of a v6 payload block are
+ * packed MSB first like the 12-bit ones, which leaves the lowest eight bits of
+ * the third word unused.
+ */
+static inline void
+ufo_decode_pixels_v6_11 (uint16_t *pixel_buffer, const uint32_t *raw, size_t space)
+{
+    pixel_buffer[0 * space] = (raw[0] >> 21);
+    pixel_buffer[1 * space] = (raw[0] >> 10) & 0x7ff;
+    pixel_buffer[2 * space] = ((raw[0] << 1) | (raw[1] >> 31)) & 0x7ff;
+    pixel_buffer[3 * space] = (raw[1] >> 20) & 0x7ff;
+    pixel_buffer[4 * space] = (raw[1] >> 9) & 0x7ff;
+    pixel_buffer[5 * space] = ((raw[1] << 2) | (raw[2] >> 30)) & 0x7ff;
+    pixel_buffer[6 * space] = (raw[2] >> 19) & 0x7ff;
+    pixel_buffer[7 * space] = (raw[2] >> 8) & 0x7ff;
+}
+
+/*
+ * Unpack the eight 12-bit pixels in one half of a v6 payload block.
+ */
+static inline void
+ufo_decode_pixels_v6 (uint16_t *pixel_buffer, const uint32_t *raw, size_t space)
+{
+    pixel_buffer[0 * space] = (raw[0] >> 20);
+    pixel_buffer[1 * space] = (raw[0] >> 8) & 0xfff;
+    pixel_buffer[2 * space] = ((raw[0] << 4) & 0xfff) | (raw[1] >> 28);
+    pixel_buffer[3 * space] = (raw[1] >> 16) & 0xfff;
+    pixel_buffer[4 * space] = (raw[1] >> 4) & 0xfff;
+    pixel_buffer[5 * space] = ((raw[1] << 8) & 0xfff) | (raw[2] >> 24);
+    pixel_buffer[6 * space] = (raw[2] >> 12) & 0xfff;
+    pixel_buffer[7 * space] = raw[2] & 0xfff;
+}
+
+/*
+ * Decode the dataformat v6 payload blocks that contain pixels of the region of
+ * interest, see ufo_decode_frame_channels_v5_roi.
+ */
+static size_t
+ufo_decode_frame_channels_v6_roi (UfoDecoder *decoder, uint16_t *pixels, const uint32_t *raw, size_t num_bytes,
+                                  uint16_t start_offset, uint8_t adc_resolution, size_t *first)
+{
+    const size_t space = IPECAMERA_PIXELS_PER_CHANNEL;
+    const size_t second_half = IPECAMERA_V6_SECOND_HALF (decoder->width);
+    const size_t second_row = second_half / decoder->width;
+    const size_t second_column = second_half % decoder->width;
+    const size_t end_row = decoder->roi_y + decoder->roi_height;
+    uint16_t values[8];
+    size_t base = 0;
+
+    while (((base * 4 + 32) <= num_bytes) && (raw[base] != 0xAAAAAAA) && !ufo_is_frame_header (raw + base)) {
+        const size_t row = (raw[base] & 0xfff) - start_offset;
+        const size_t column = (raw[base + 1] >> 16) & 0xfff;
+
+        /* Rows below the start address wrap around and are left alone */
+        if ((first != NULL) && (row < IPECAMERA_MAX_ROWS)) {
+            if (row >= end_row)
+                break;
+
+            if ((*first == SIZE_MAX) && ((row + second_row) >= decoder->roi_y))
+                *first = base;
+        }
+
+        for (size_t half = 0; half < 2; half++) {
+            const size_t half_row = row + half * second_row;
+            const size_t half_column = column + half * second_column;
+            const uint32_t *half_raw = raw + base + 2 + half * 3;
+
+            if (!ufo_roi_contains (decoder, half_row, half_column, 8, space))
+                continue;
+
+            if (adc_resolution == IPECAMERA_MODE_11_BIT_ADC)
+                ufo_decode_pixels_v6_11 (values, half_raw, 1);
+            else
+                ufo_decode_pixels_v6 (values, half_raw, 1);
+
+            ufo_roi_store (decoder, pixels, half_row, half_column, values, 8, space);
+        }
+
+        base += 8;
+
+        if ((raw[base] & 0xFF000000) == 0xC0000000)
+            base += 8;
+    }
+
+    return base;
+}
+
+static size_t
+ufo_decode_frame_channels_v6 (UfoDecoder *decoder, uint16_t *pixel_buffer, uint32_t *raw, size_t num_bytes, size_t num_rows, uint16_t start_offset, uint8_t adc_resolution)
+{
+    size_t base = 0;
+    size_t index = 0;
+    const size_t width = decoder->width;
+    const size_t space = IPECAMERA_PIXELS_PER_CHANNEL;
+    const UfoDecodeBlocksV6Func decode_blocks = adc_resolution == IPECAMERA_MODE_11_BIT_ADC ?
+        decoder->decode_blocks_v6_11 : decoder->decode_blocks_v6;
+
+#ifdef HAVE_SSE
+    const __m64 mask_fff = _mm_set_pi32 (0xfff, 0xfff);
+    __m64 mm_r;
+#endif
+
+    if (decoder->roi_width > 0)
+        return ufo_decode_frame_channels_v6_roi (decoder, pixel_buffer, raw, num_bytes, start_offset, adc_resolution, NULL);
+
+    while (((base * 4 + 32) <= num_bytes) && (raw[base] != 0xAAAAAAA) && !ufo_is_frame_header (raw + base)) {
+        if (decode_blocks != NULL) {
+            const size_t advance = decode_blocks (pixel_buffer, raw + base, (num_bytes - base * 4) / 32, start_offset, width, num_rows);
+
+            if (advance > 0) {
+                base += advance;
+
+                if ((raw[base] & 0xFF000000) == 0xC0000000)
+                    base += 8;
+
+                continue;
+            }
+        }
+
+        const size_t row_number = (raw[base] & 0xfff) - start_offset;
+        const size_t pixel_number = (raw[base + 1] >> 16) & 0xfff;
+
+        /* A corrupt header may point outside of the frame */
+        if (!ufo_block_fits_v6 (row_number, pixel_number, width, num_rows)) {
+            base += 8;
+
+            if ((raw[base] & 0xFF000000) == 0xC0000000)
+                base += 8;
+
+            continue;
+        }
+
+        base += 2;
+        index = row_number * width + pixel_number;
+
+        if (adc_resolution == IPECAMERA_MODE_11_BIT_ADC) {
+            ufo_decode_pixels_v6_11 (pixel_buffer + index, raw + base, space);
+            ufo_decode_pixels_v6_11 (pixel_buffer + index + IPECAMERA_V6_SECOND_HALF (width), raw + base + 3, space);
+        }
+        else {
+#ifdef HAVE_SSE
+            const __m64 src1 = _mm_set_pi32 (raw[base], raw[base + 3]);
+            const __m64 src2 = _mm_set_pi32 (raw[base + 1], raw[base + 4]);
+            const __m64 src3 = _mm_set_pi32 (raw[base + 2], raw[base + 5]);
+
+#define store(i) \
+            pixel_buffer[index + i * space] = ((uint32_t *) &mm_r)[1]; \
+            pixel_buffer[index + width + i * space] = ((uint32_t *) &mm_r)[0];
+
+            mm_r = _mm_srli_pi32 (src1, 20);
+            store(0);
+
+            mm_r = _mm_and_si64 (_mm_srli_pi32 (src1, 8), mask_fff);
+            store(1);
+
+            mm_r = _mm_or_si64 (_mm_and_si64 (_mm_slli_pi32 (src1, 4), mask_fff), _mm_srli_pi32 (src2, 28));
+            store(2);
+
+            mm_r = _mm_and_si64 (_mm_srli_pi32 (src2, 16), mask_fff);
+            store(3);
+
+            mm_r = _mm_and_si64 (_mm_srli_pi32 (src2, 4), mask_fff);
+            store(4);
+
+            mm_r = _mm_or_si64 (_mm_and_si64 (_mm_slli_pi32 (src2, 8), mask_fff), _mm_srli_pi32 (src3, 24));
+            store(5);
+
+            mm_r = _mm_and_si64 (_mm_srli_pi32 (src3, 12), mask_fff);
+            store(6);
+
+            mm_r = _mm_and_si64 (src3, mask_fff);
+            store(7);
+
+#undef store
+#else
+            ufo_decode_pixels_v6 (pixel_buffer + index, raw + base, space);
+            ufo_decode_pixels_v6 (pixel_buffer + index + 8 * space, raw + base + 3, space);
+#endif
+        }
+
+        base += 6;
+
+        if ((raw[base] & 0xFF000000) == 0xC0000000) {
+            base += 8;
+        }
+    }
+
+    return base;
+}
+
+typedef struct {
+    UfoDecoder     *decoder;
+    uint16_t       *pixels;
+    uint32_t       *raw;
+    size_t          num_bytes;
+    size_t          chunk_size;
+    int             dataformat_version;
+    UfoDecoderMeta *meta;
+} UfoPayloadJob;
+
+/*
+ * Scan the block headers of one chunk for the end of the payload, a position
+ * where decoding can start and the 4 channel offset changes.
+ */
+static void
+ufo_scan_payload_chunk (void *data, size_t index)
+{
+    UfoPayloadJob *job = (UfoPayloadJob *) data;
+    UfoPayloadRange *range = &job->decoder->ranges[index];
+    const uint32_t *raw = job->raw;
+    const size_t start = index * job->chunk_size;
+    const size_t end = start + job->chunk_size;
+
+    range->start = job->dataformat_version == 6 ? SIZE_MAX : start;
+    range->stop = SIZE_MAX;
+    range->num_e0 = 0;
+    range->has_c0 = false;
+
+    for (size_t base = start; base < end; base += 8) {
+        if ((base * 4 + 32 > job->num_bytes) || (raw[base] == 0xAAAAAAA) || ufo_is_frame_header (raw + base)) {
+            range->stop = base;
+            break;
+        }
+
+        if (job->dataformat_version == 6) {
+            /*
+             * A 0xC0 word is skipped if it follows a block, so we can only be
+             * sure that we are at a block if neither this nor the previous
+             * position is a 0xC0 word.
+             */
+            if ((range->start == SIZE_MAX) &&
+                ((base == 0) || (((raw[base - 8] & 0xFF000000) != 0xC0000000) && ((raw[base] & 0xFF000000) != 0xC0000000))))
+                range->start = base;
+        }
+        else if (job->meta->output_mode == IPECAMERA_MODE_4_CHAN_IO) {
+            const payload_header_v5 *header = (const payload_header_v5 *) &raw[base];
+
+            if (header->magic == 0xe0)
+                range->num_e0++;
+            else if (header->magic == 0xc0) {
+                range->num_e0 = 0;
+                range->has_c0 = true;
+            }
+        }
+    }
+}
+
+static void
+ufo_decode_payload_range (void *data, size_t index)
+{
+    UfoPayloadJob *job = (UfoPayloadJob *) data;
+    UfoDecoder *decoder = job->decoder;
+    const UfoPayloadRange *range = &decoder->ranges[index];
+    const size_t num_bytes = (range->end - range->start) * 4;
+    size_t off = range->off;
+
+    if (job->dataformat_version == 6)
+        ufo_decode_frame_channels_v6 (decoder, job->pixels, job->raw + range->start, num_bytes, ufo_decoder_get_num_rows (decoder),
+                                      job->meta->cmosis_start_address, job->meta->adc_resolution);
+    else
+        ufo_decode_frame_channels_v5 (decoder, job->pixels, job->raw + range->start, num_bytes, ufo_decoder_get_num_rows (decoder),
+                                      job->meta->output_mode, &off);
+}
+
+/*
+ * Decode the payload in parallel. The payload is cut into one chunk per
+ * thread, based on the size of the previous frame. In a first pass the
+ * threads look for the footer and for safe positions to start decoding, in
+ * the second pass they decode the parts in between. Returns false if the
+ * payload could not be split, e.g. because it is larger than expected.
+ */
+static bool
+ufo_decode_frame_channels_threaded (UfoDecoder *decoder, uint16_t *pixels, uint32_t *raw, size_t num_bytes,
+                                    int dataformat_version, UfoDecoderMeta *meta, size_t *advance)
+{
+    const size_t num_chunks = ufo_thread_pool_get_num_threads (decoder->pool);
+    const size_t expected = decoder->payload_words + decoder->payload_words / 8 + 8;
+    UfoPayloadRange *ranges = decoder->ranges;
+    UfoPayloadJob job;
+    size_t num_ranges = 0;
+    size_t stop = SIZE_MAX;
+    size_t off = 0;
+
+    if (decoder->payload_words == 0)
+        return false;
+
+    job.decoder = decoder;
+    job.pixels = pixels;
+    job.raw = raw;
+    job.num_bytes = num_bytes;
+    job.chunk_size = ((expected + num_chunks - 1) / num_chunks + 7) & ~((size_t) 7);
+    job.dataformat_version = dataformat_version;
+    job.meta = meta;
+
+    ufo_thread_pool_run (decoder->pool, ufo_scan_payload_chunk, &job, num_chunks);
+
+    for (size_t i = 0; i < num_chunks && stop == SIZE_MAX; i++) {
+        const size_t start = ranges[i].start;
+        const size_t off_at_start = off;
+
+        off = ranges[i].has_c0 ? ranges[i].num_e0 : off + ranges[i].num_e0;
+        stop = ranges[i].stop;
+
+        if (start != SIZE_MAX) {
+            ranges[num_ranges].start = start;
+            ranges[num_ranges].off = off_at_start;
+            num_ranges++;
+        }
+    }
+
+    if (stop == SIZE_MAX)
+        return false;
+
+    for (size_t i = 0; i < num_ranges; i++)
+        ranges[i].end = i + 1 < num_ranges ? ranges[i + 1].start : stop;
+
+    ufo_thread_pool_run (decoder->pool, ufo_decode_payload_range, &job, num_ranges);
+
+    *advance = stop;
+    return true;
+}
+
+/*
+ * Run func for num_bands bands on the threads of pool, or on the calling
+ * thread if there is no pool.
+ */
+static void
+ufo_run_bands (UfoThreadPool *pool, UfoTaskFunc func, void *data, size_t num_bands)
+{
+    if (pool != NULL)
+        ufo_thread_pool_run (pool, func, data, num_bands);
+    else {
+        for (size_t i = 0; i < num_bands; i++)
+            func (data, i);
+    }
+}
+
+/*
+ * Rounds down like the floating point average this replaces, without the
+ * overflow of a + b.
+ */
+static void
+ufo_average_rows (const uint16_t *a, const uint16_t *b, uint16_t *out, size_t num_pixels)
+{
+    for (size_t i = 0; i < num_pixels; i++)
+        out[i] = (a[i] & b[i]) + ((a[i] ^ b[i]) >> 1);
+}
+
+typedef struct {
+    const uint16_t     *in1;
+    const uint16_t     *in2;
+    uint16_t           *out;
+    size_t              width;
+    size_t              height;
+    size_t              num_bands;
+    UfoAverageRowsFunc  average;
+} UfoDeinterlaceJob;
+
+static void
+ufo_interpolate_band (void *data, size_t index)
+{
+    UfoDeinterlaceJob *job = (UfoDeinterlaceJob *) data;
+    const size_t width = job->width;
+    const size_t first = job->height * index / job->num_bands;
+    const size_t last = job->height * (index + 1) / job->num_bands;
+
+    for (size_t row = first; row < last; row++) {
+        const uint16_t *in = job->in1 + row * width;
+        uint16_t *out = job->out + 2 * row * width;
+
+        memcpy (out, in, width * sizeof (uint16_t));
+
+        /* The last row has nothing to interpolate with and is repeated */
+        if (row + 1 < job->height)
+            job->average (in, in + width, out + width, width);
+        else
+            memcpy (out + width, in, width * sizeof (uint16_t));
+    }
+}
+
+static void
+ufo_weave_band (void *data, size_t index)
+{
+    UfoDeinterlaceJob *job = (UfoDeinterlaceJob *) data;
+    const size_t width = job->width;
+    const size_t first = job->height * index / job->num_bands;
+    const size_t last = job->height * (index + 1) / job->num_bands;
+
+    for (size_t row = first; row < last; row++) {
+        uint16_t *out = job->out + 2 * row * width;
+
+        memcpy (out, job->in1 + row * width, width * sizeof (uint16_t));
+        memcpy (out + width, job->in2 + row * width, width * sizeof (uint16_t));
+    }
+}
+
+static void
+ufo_deinterlace (UfoThreadPool *pool, UfoTaskFunc func, const uint16_t *in1, const uint16_t *in2, uint16_t *out,
+                 int width, int height)
+{
+    UfoDeinterlaceJob job;
+
+    if (width <= 0 || height <= 0)
+        return;
+
+    job.in1 = in1;
+    job.in2 = in2;
+    job.out = out;
+    job.width = width;
+    job.height = height;
+    job.num_bands = pool != NULL ? ufo_thread_pool_get_num_threads (pool) : 1;
+    job.average = ufo_average_rows;
+
+#ifdef HAVE_AVX2
+    if (ufo_use_avx2 ())
+        job.average = ufo_average_rows_avx2;
+#endif
+
+    ufo_run_bands (pool, func, &job, job.num_bands);
+}
+
+/**
+ * \brief Deinterlace by interpolating between two rows
+ *
+ * Each row is followed by the average of itself and the next row, rounded
+ * down. The last row is repeated, so that the output has twice as many rows
+ * as the input.
+ *
+ * \param in Input frame
+ * \param out Destination of interpolated frame
+ * \param width Width of frame in pixels
+ * \param height Height of frame in pixels
+ */
+void
+ufo_deinterlace_interpolate (const uint16_t *in, uint16_t *out, int width, int height)
+{
+    ufo_deinterlace (NULL, ufo_interpolate_band, in, NULL, out, width, height);
+}
+
+/**
+ * \brief Deinterlace by "weaving" the rows of two frames
+ *
+ * \param in1 First frame
+ * \param in2 Second frame
+ * \param out Destination of weaved frame
+ * \param width Width of frame in pixels
+ * \param height Height of frame in pixels
+ */
+void
+ufo_deinterlace_weave (const uint16_t *in1, const uint16_t *in2, uint16_t *out, int width, int height)
+{
+    ufo_deinterlace (NULL, ufo_weave_band, in1, in2, out, width, height);
+}
+
+/**
+ * \brief Deinterlace by interpolating with the threads of a decoder
+ *
+ * Same as ufo_deinterlace_interpolate, but bands of rows are processed by the
+ * threads set up with ufo_decoder_set_num_threads.
+ *
+ * \param decoder An UfoDecoder instance
+ * \param in Input frame
+ * \param out Destination of interpolated frame
+ * \param width Width of frame in pixels
+ * \param height Height of frame in pixels
+ */
+void
+ufo_decoder_deinterlace_interpolate (UfoDecoder *decoder, const uint16_t *in, uint16_t *out, int width, int height)
+{
+    ufo_deinterlace (decoder->pool, ufo_interpolate_band, in, NULL, out, width, height);
+}
+
+/**
+ * \brief Deinterlace by weaving with the threads of a decoder
+ *
+ * Same as ufo_deinterlace_weave, but bands of rows are processed by the
+ * threads set up with ufo_decoder_set_num_threads.
+ *
+ * \param decoder An UfoDecoder instance
+ * \param in1 First frame
+ * \param in2 Second frame
+ * \param out Destination of weaved frame
+ * \param width Width of frame in pixels
+ * \param height Height of frame in pixels
+ */
+void
+ufo_decoder_deinterlace_weave (UfoDecoder *decoder, const uint16_t *in1, const uint16_t *in2, uint16_t *out,
+                               int width, int height)
+{
+    ufo_deinterlace (decoder->pool, ufo_weave_band, in1, in2, out, width, height);
+}
+
+/*
+ * Check the header at raw and fill meta from it. Returns non-zero if the
+ * header is corrupt.
+ */
+static int
+ufo_decode_header (const uint32_t *raw, UfoDecoderMeta *meta, int *dataformat_version)
+{
+    int err = 0;
+    const pre_header_t *pre_header;
+
+    pre_header = (const pre_header_t *) raw;
+
+    CHECK_VALUE (pre_header->five, 0x5);
+    CHECK_VALUE (pre_header->ones, 0x111111);
+
+    const int header_version = pre_header->version + 5;    /* it starts with 0 */
+    *dataformat_version = 5;        /* will overwrite for header_version >= 6 */
 
     switch (header_version) {
         case 5:
-            {
-                const header_v5_t *header = (header_v5_t *) &raw[pos + 1];
+            {
+                const header_v5_t *header = (const header_v5_t *) &raw[1];
+
+                CHECK_VALUE (header->magic_2, 0x52222222);
+                CHECK_VALUE (header->magic_3, 0x53333333);
+                CHECK_VALUE (header->magic_4, 0x54444444);
+                CHECK_VALUE (header->magic_5, 0x55555555);
+
+                CHECK_VALUE (header->five_1, 0x5);
+                CHECK_VALUE (header->five_2, 0x5);
+
+                meta->time_stamp = header->timestamp;
+                meta->cmosis_start_address = header->cmosis_start_address;
+                meta->frame_number = header->frame_number;
+                meta->n_rows = header->n_rows;
+                meta->n_skipped_rows = header->n_skipped_rows;
+                break;
+            }
+
+        case 6:
+            {
+                const header_v6_t *header = (const header_v6_t *) &raw[1];
+                CHECK_VALUE (header->magic_2, 0x52222222);
+                CHECK_VALUE (header->magic_3, 0x53333333);
+
+                *dataformat_version = header->dataformat_version;
+
+                meta->output_mode = header->output_mode;
+                meta->adc_resolution = header->adc_resolution;
+                meta->time_stamp = header->timestamp;
+                meta->cmosis_start_address = header->cmosis_start_address;
+                meta->frame_number = header->frame_number;
+                meta->n_rows = header->n_rows;
+                meta->n_skipped_rows = header->n_skipped_rows;
+
+                break;
+            }
+
+        default:
+            fprintf (stderr, "Unsupported header version %i\n", header_version);
+    }
+
+    return err;
+}
+
+/*
+ * Check the footer at raw and fill the status words of meta from it. Returns
+ * non-zero if the footer is corrupt.
+ */
+static int
+ufo_decode_footer (const uint32_t *raw, UfoDecoderMeta *meta)
+{
+    int err = 0;
+
+    CHECK_VALUE(raw[0], 0x0AAAAAAA);
+
+    meta->status1.bits = raw[1];
+    meta->status2.bits = raw[2];
+    meta->status3.bits = raw[3];
+
+    CHECK_VALUE(raw[6], 0x00000000);
+    CHECK_VALUE(raw[7], 0x01111111);
+
+    return err;
+}
+
+/*
+ * Position of the footer in the payload at raw. The position where the footer
+ * of the previous frame was found is tried first, otherwise the block headers
+ * are checked one by one just as the payload decoders do.
+ */
+static size_t
+ufo_find_payload_end (const uint32_t *raw, size_t num_words, size_t guess)
+{
+    size_t base = 0;
+
+    if ((guess > 0) && ((guess + 8) <= num_words) &&
+        (raw[guess] == 0xAAAAAAA) && (raw[guess + 6] == 0x0) && (raw[guess + 7] == 0x1111111))
+        return guess;
+
+    while (((base + 8) <= num_words) && (raw[base] != 0xAAAAAAA) && !ufo_is_frame_header (raw + base))
+        base += 8;
+
+    return base;
+}
+
+/*
+ * Whether the region of interest starts at the payload block at guess, which
+ * is where it started in the previous frame. The block must reach into the
+ * region and the block before it must lie above, while the header promises
+ * enough rows. Not used in the 4 channel mode, whose channel offset is only
+ * known after walking all blocks.
+ */
+static bool
+ufo_roi_starts_at (UfoDecoder *decoder, const uint32_t *raw, size_t num_words, size_t guess, int dataformat_version,
+                   const UfoDecoderMeta *meta)
+{
+    size_t prev = guess - 8;
+    size_t row, last_row, prev_last_row;
+
+    if ((guess < 8) || ((guess + 8) > num_words) || (meta->n_rows <= decoder->roi_y) || ufo_is_marker (raw[guess]))
+        return false;
+
+    if (dataformat_version == 6) {
+        const size_t second_row = IPECAMERA_V6_SECOND_HALF (decoder->width) / decoder->width;
+
+        if (((raw[prev] & 0xFF000000) == 0xC0000000) && (prev >= 8))
+            prev -= 8;
+
+        if (((raw[guess] & 0xFF000000) == 0xC0000000) || ufo_is_marker (raw[prev]))
+            return false;
+
+        row = (raw[guess] & 0xfff) - meta->cmosis_start_address;
+        last_row = row + second_row;
+        prev_last_row = (raw[prev] & 0xfff) - meta->cmosis_start_address + second_row;
+    }
+    else {
+        const payload_header_v5 *header = (const payload_header_v5 *) &raw[guess];
+
+        if ((meta->output_mode == IPECAMERA_MODE_4_CHAN_IO) || (header->magic == 0xc0) || ufo_is_marker (raw[prev]))
+            return false;
+
+        row = last_row = header->row_number;
+        prev_last_row = ((const payload_header_v5 *) &raw[prev])->row_number;
+    }
+
+    return (prev_last_row < decoder->roi_y) && (last_row >= decoder->roi_y) &&
+           (row < decoder->roi_y + decoder->roi_height);
+}
+
+/*
+ * Decode the payload at raw into the region of interest without walking over
+ * all blocks. Those above the region are jumped over if the region starts
+ * where it did in the previous frame, those below it by looking for the footer
+ * where it was in the previous frame. Both positions are only remembered if
+ * update is true, which is not the case when frames are decoded in parallel.
+ */
+static size_t
+ufo_decode_payload_roi (UfoDecoder *decoder, uint16_t *pixels, const uint32_t *raw, size_t num_bytes,
+                        int dataformat_version, const UfoDecoderMeta *meta, bool update)
+{
+    const size_t num_words = num_bytes / 4;
+    const size_t guess = decoder->payload_words;
+    size_t start = 0, first = SIZE_MAX, off = 0;
+    size_t end;
+
+    if ((decoder->roi_start > 0) &&
+        ufo_roi_starts_at (decoder, raw, num_words, decoder->roi_start, dataformat_version, meta))
+        start = decoder->roi_start;
+
+    if (dataformat_version == 6)
+        end = start + ufo_decode_frame_channels_v6_roi (decoder, pixels, raw + start, num_bytes - start * 4,
+                                                        meta->cmosis_start_address, meta->adc_resolution, &first);
+    else
+        end = start + ufo_decode_frame_channels_v5_roi (decoder, pixels, raw + start, num_bytes - start * 4,
+                                                        meta->output_mode, &off, &first);
+
+    end += ufo_find_payload_end (raw + end, num_words - end, guess > end ? guess - end : 0);
+
+    if (update)
+        decoder->roi_start = first != SIZE_MAX ? start + first : 0;
+
+    return end;
+}
+
+/*
+ * Decode the frame at raw. The payload is only split across the threads of the
+ * pool if threaded is true, which is not the case when whole frames are
+ * decoded in parallel. Timing is added to stats.
+ */
+static size_t
+ufo_decode_frame (UfoDecoder *decoder, uint32_t *raw, size_t num_bytes, uint16_t *pixels, UfoDecoderMeta *meta, bool threaded,
+                  UfoDecoderStats *stats)
+{
+    int err = 0;
+    size_t pos = 0;
+    size_t advance = 0;
+    size_t off = 0;
+    const size_t num_words = num_bytes / 4;
+    const size_t num_rows = ufo_decoder_get_num_rows (decoder);
+    int dataformat_version;
+    uint64_t start_time;
+    uint64_t payload_time;
+
+    if ((pixels == NULL) || (num_words < 16))
+        return 0;
+
+    start_time = ufo_decoder_now (decoder);
+    err = ufo_decode_header (raw, meta, &dataformat_version);
+    payload_time = ufo_decoder_now (decoder);
+    stats->header_ns += payload_time - start_time;
+
+#ifdef DEBUG
+    if ((meta->output_mode != IPECAMERA_MODE_4_CHAN_IO) && (meta->output_mode != IPECAMERA_MODE_16_CHAN_IO)) {
+        fprintf (stderr, "Output mode 0x%x is not supported\n", meta->output_mode);
+        return EILSEQ;
+    }
+
+    if (err) {
+        fprintf (stderr, "Corrupt data:");
+
+        for (int i = 0; i < pos; i++) {
+            if ((i % 8) == 0)
+                fprintf (stderr, "\n");
+
+            fprintf (stderr, " %#08x", raw[i]);
+        }
+
+        fprintf (stderr, "\n");
+        return 0;
+    }
+#endif
+
+    /* Do not waste time on the payload of a frame that is rejected anyway */
+    if (err)
+        return 0;
+
+    pos += 8;
+
+    switch (dataformat_version) {
+        case 5:
+            if (decoder->roi_width > 0) {
+                advance = ufo_decode_payload_roi (decoder, pixels, raw + pos, num_bytes - pos * 4, dataformat_version, meta, threaded);
+                break;
+            }
+
+            if (threaded && decoder->pool != NULL &&
+                ufo_decode_frame_channels_threaded (decoder, pixels, raw + pos, num_bytes - pos * 4, dataformat_version, meta, &advance))
+                break;
+
+            advance = ufo_decode_frame_channels_v5 (decoder, pixels, raw + pos, num_bytes - pos * 4, num_rows, meta->output_mode, &off);
+            break;
+
+        case 6:
+            if (decoder->roi_width > 0) {
+                advance = ufo_decode_payload_roi (decoder, pixels, raw + pos, num_bytes - pos * 4, dataformat_version, meta, threaded);
+                break;
+            }
+
+            if (threaded && decoder->pool != NULL &&
+                ufo_decode_frame_channels_threaded (decoder, pixels, raw + pos, num_bytes - pos * 4, dataformat_version, meta, &advance))
+                break;
+
+            advance = ufo_decode_frame_channels_v6 (decoder, pixels, raw + pos, num_bytes - pos * 4, num_rows, meta->cmosis_start_address, meta->adc_resolution);
+            break;
+
+        default:
+            fprintf (stderr, "Data format version %i unsupported\n", dataformat_version);
+    }
+
+    start_time = ufo_decoder_now (decoder);
+    stats->payload_ns += start_time - payload_time;
+
+    if (err)
+        return 0;
+
+    if (threaded)
+        decoder->payload_words = advance;
+
+    pos += advance;
+
+    /* The payload ran up to the end of the data, there is no footer */
+    if (pos + 8 > num_words)
+        return 0;
+
+    err = ufo_decode_footer (raw + pos, meta);
+    pos += 8;
+    stats->header_ns += ufo_decoder_now (decoder) - start_time;
+
+    if (err)
+        return 0;
+
+    return pos;
+}
+
+/**
+ * \brief Decodes frame
+ *
+ * This function tries to decode the supplied data
+ *
+ * \param decoder An UfoDecoder instance
+ * \param raw Raw data stream
+ * \param num_bytes Size of data stream buffer in bytes
+ * \param pixels If pointer with NULL content is passed, a new buffer is
+ * allocated otherwise, this user-supplied buffer is used.
+ * \param frame_number Frame number as reported in the header
+ * \param time_stamp Time stamp of the frame as reported in the header
+ *
+ * \return number of decoded bytes or 0 in case of error
+ */
+size_t
+ufo_decoder_decode_frame (UfoDecoder *decoder, uint32_t *raw, size_t num_bytes, uint16_t *pixels, UfoDecoderMeta *meta)
+{
+    const size_t advance = ufo_decode_frame (decoder, raw, num_bytes, pixels, meta, true, &decoder->stats);
+
+    ufo_decoder_count_frame (decoder, advance);
+    return advance;
+}
+
+/*
+ * Position of the next frame at or after pos or SIZE_MAX if the end of the
+ * stream is reached.
+ */
+static size_t
+ufo_decoder_find_frame (UfoDecoder *decoder, size_t pos)
+{
+    const uint32_t *raw = decoder->raw;
+    const size_t num_words = decoder->num_bytes / 4;
+
+    if ((pos >= num_words) || ((num_words - pos) < 4096))
+        return SIZE_MAX;
+
+    while (pos < num_words) {
+        pos += decoder->find_marker (raw + pos, num_words - pos);
+
+        /* we can only match the first part */
+        if ((pos < num_words) && ((raw[pos] & 0xFFFFFFF0) == 0x51111110))
+            return pos;
+
+        pos++;
+    }
+
+    return SIZE_MAX;
+}
+
+/*
+ * Position of the first frame after pos that has a footer before the next
+ * frame header or the end of the stream if there is none. Frames that lost
+ * their end are skipped without decoding them.
+ */
+static size_t
+ufo_decoder_find_valid_frame (UfoDecoder *decoder, size_t pos)
+{
+    const uint32_t *raw = decoder->raw;
+    const size_t num_words = decoder->num_bytes / 4;
+    size_t start = SIZE_MAX;
+
+    while (pos + 8 <= num_words) {
+        pos += decoder->find_marker (raw + pos, num_words - pos);
+
+        if (pos + 8 > num_words)
+            break;
+
+        if (ufo_is_frame_header (raw + pos)) {
+            start = pos;
+            pos += 8;
+            continue;
+        }
+
+        if ((start != SIZE_MAX) && (raw[pos] == 0x0AAAAAAA) && (raw[pos + 7] == 0x01111111))
+            return start;
+
+        pos++;
+    }
+
+    return num_words;
+}
+
+static inline bool
+ufo_is_fill_word (uint32_t word)
+{
+    return (word == 0x89abcdef) || (word == 0x1234567) ||
+           (word == 0x0) || (word == 0xdeadbeef) || (word == 0x98badcfe);     /* new filling ... */
+}
+
+/*
+ * Position after the frame at pos that consumed advance words, including any
+ * fill words following it.
+ */
+static size_t
+ufo_decoder_skip_frame (UfoDecoder *decoder, size_t pos, size_t advance)
+{
+    const uint32_t *raw = decoder->raw;
+    const size_t num_words = decoder->num_bytes / 4;
+
+    /*
+     * On error, advance is 0. Continue with the next frame that looks complete
+     * instead of trying every frame header in the damaged part.
+     */
+    if (advance == 0)
+        return ufo_decoder_find_valid_frame (decoder, pos + 1);
+
+    pos += advance;
+
+    /* if bytes left and we see fill bytes, skip them */
+    if (((pos + 2) < num_words) && ((raw[pos] == 0x0) && ((raw[pos+1] == 0x1111111) || raw[pos+1] == 0x0))) {
+        pos += 2;
+        while ((pos < num_words) && ufo_is_fill_word (raw[pos]))
+            pos++;
+    }
+
+    return pos;
+}
+
+/**
+ * \brief Iterate and decode next frame
+ *
+ * This function tries to decode the next frame in the currently set raw data
+ * stream.
+ *
+ * \param decoder An UfoDecoder instance
+ * \param pixels If pointer with NULL content is passed, a new buffer is
+ * allocated otherwise, this user-supplied buffer is used.
+ * \param num_rows Number of actual decoded rows
+ * \param frame_number Frame number as reported in the header
+ * \param time_stamp Time stamp of the frame as reported in the header
+ *
+ * \return 0 in case of no error, EIO if end of stream was reached, ENOMEM if
+ * NULL was passed but no memory could be allocated, EILSEQ if data stream is
+ * corrupt and EFAULT if pixels is a NULL-pointer.
+ */
+int
+ufo_decoder_get_next_frame (UfoDecoder *decoder, uint16_t **pixels, UfoDecoderMeta *meta)
+{
+    uint32_t *raw = decoder->raw;
+    size_t pos = decoder->current_pos;
+    size_t start;
+    size_t advance;
+    uint64_t scan_time;
+    const size_t num_words = decoder->num_bytes / 4;
+
+    if (pixels == NULL)
+        return 0;
+
+    if ((pos >= num_words) || ((num_words - pos) < 4096))
+        return EIO;
+
+    if (num_words < 16)
+        return EILSEQ;
+
+    if (*pixels == NULL) {
+        *pixels = ufo_decoder_alloc_frame (decoder);
+
+        if (*pixels == NULL)
+            return ENOMEM;
+    }
+
+    scan_time = ufo_decoder_now (decoder);
+    start = ufo_decoder_find_frame (decoder, pos);
+    decoder->stats.scan_ns += ufo_decoder_now (decoder) - scan_time;
+
+    /* before even attempting to decode the non-existent frame, bail out */
+    if (start == SIZE_MAX)
+        return EIO;
+
+    advance = ufo_decode_frame (decoder, raw + start, decoder->num_bytes - start * 4, *pixels, meta, true, &decoder->stats);
+
+    scan_time = ufo_decoder_now (decoder);
+    decoder->current_pos = ufo_decoder_skip_frame (decoder, start, advance);
+    decoder->stats.scan_ns += ufo_decoder_now (decoder) - scan_time;
+
+    ufo_decoder_count_span (decoder, pos, start, advance, decoder->current_pos);
+
+    if (!advance)
+        return EILSEQ;
+
+    return 0;
+}
+
+typedef struct {
+    UfoDecoder     *decoder;
+    UfoFrameSlot   *slots;
+} UfoBatchJob;
+
+static void
+ufo_decode_frame_slot (void *data, size_t index)
+{
+    UfoBatchJob *job = (UfoBatchJob *) data;
+    UfoDecoder *decoder = job->decoder;
+    UfoFrameSlot *slot = &job->slots[index];
+
+    slot->stats.header_ns = 0;
+    slot->stats.payload_ns = 0;
+    slot->advance = ufo_decode_frame (decoder, decoder->raw + slot->start, decoder->num_bytes - slot->start * 4,
+                                      slot->pixels, &slot->meta, false, &slot->stats);
+}
+
+static bool
+ufo_is_frame_start (const uint32_t *raw, size_t pos, size_t num_words)
+{
+    return ((pos + 1) < num_words) && ufo_is_frame_header (raw + pos);
+}
+
+/*
+ * Guess the start of the frame following the one at start. Frames are
+ * expected to be about as far apart as the last two, give or take a few
+ * skipped blocks, so the closest frame start within a window around that
+ * distance is picked. Returns SIZE_MAX if there is none.
+ */
+static size_t
+ufo_decoder_guess_next_frame (UfoDecoder *decoder, size_t start)
+{
+    const uint32_t *raw = decoder->raw;
+    const size_t num_words = decoder->num_bytes / 4;
+    const size_t window = decoder->frame_words / 16 + 64;
+    const size_t guess = start + decoder->frame_words;
+    const size_t first = guess > start + window ? guess - window : start + 1;
+
+    for (size_t pos = guess; pos < guess + window && pos < num_words; pos++) {
+        if (ufo_is_frame_start (raw, pos, num_words))
+            return pos;
+    }
+
+    for (size_t pos = guess; pos > first; pos--) {
+        if (ufo_is_frame_start (raw, pos - 1, num_words))
+            return pos - 1;
+    }
+
+    return SIZE_MAX;
+}
+
+/*
+ * Decode the next batch of at most num_slots frames into slots. The starts of
+ * the frames following the first one are guessed. After decoding, the frames
+ * are checked in stream order against the positions ufo_decoder_get_next_frame
+ * would have found and the batch is cut at the first wrong guess, so the
+ * frames are the same as with sequential decoding. It is also cut after the
+ * first corrupt frame, whose successors are only found by resyncing. Returns
+ * the number of frames in the batch, which is 0 if the end of the stream is
+ * reached.
+ */
+static size_t
+ufo_decoder_decode_batch (UfoDecoder *decoder, UfoFrameSlot *slots, size_t num_slots)
+{
+    UfoBatchJob job = { .decoder = decoder, .slots = slots };
+    size_t num_frames = 1;
+    size_t start;
+    size_t next;
+    size_t pos;
+    uint64_t scan_time;
+
+    scan_time = ufo_decoder_now (decoder);
+    start = ufo_decoder_find_frame (decoder, decoder->current_pos);
+
+    if (start == SIZE_MAX)
+        return 0;
+
+    slots[0].start = start;
+
+    if (decoder->frame_words > 0) {
+        for (; num_frames < num_slots; num_frames++) {
+            start = ufo_decoder_guess_next_frame (decoder, start);
+
+            if (start == SIZE_MAX)
+                break;
+
+            slots[num_frames].start = start;
+        }
+    }
+
+    decoder->stats.scan_ns += ufo_decoder_now (decoder) - scan_time;
+
+    if (decoder->pool != NULL && num_frames > 1)
+        ufo_thread_pool_run (decoder->pool, ufo_decode_frame_slot, &job, num_frames);
+    else
+        for (size_t i = 0; i < num_frames; i++)
+            ufo_decode_frame_slot (&job, i);
+
+    for (size_t i = 0; i < num_frames; i++) {
+        decoder->stats.header_ns += slots[i].stats.header_ns;
+        decoder->stats.payload_ns += slots[i].stats.payload_ns;
+    }
+
+    scan_time = ufo_decoder_now (decoder);
+    pos = decoder->current_pos;
+
+    for (size_t i = 0; i < num_frames; i++) {
+        const size_t from = pos;
+
+        if (i > 0 && ufo_decoder_find_frame (decoder, pos) != slots[i].start) {
+            num_frames = i;
+            break;
+        }
+
+        pos = ufo_decoder_skip_frame (decoder, slots[i].start, slots[i].advance);
+        ufo_decoder_count_span (decoder, from, slots[i].start, slots[i].advance, pos);
+
+        if (!slots[i].advance) {
+            num_frames = i + 1;
+            break;
+        }
+    }
+
+    /* The distance to the frame after a corrupt one is no good guess */
+    if (slots[num_frames - 1].advance) {
+        next = ufo_decoder_find_frame (decoder, pos);
+        decoder->frame_words = next != SIZE_MAX ? next - slots[num_frames - 1].start : 0;
+    }
+
+    decoder->current_pos = pos;
+    decoder->stats.scan_ns += ufo_decoder_now (decoder) - scan_time;
+    return num_frames;
+}
+
+/*
+ * Decode the next batch of frames into the slots of the decoder.
+ */
+static int
+ufo_decoder_decode_frames_ahead (UfoDecoder *decoder)
+{
+    decoder->num_ready = ufo_decoder_decode_batch (decoder, decoder->slots, decoder->num_slots);
+    decoder->next_slot = 0;
+    return decoder->num_ready > 0 ? 0 : EIO;
+}
+
+/**
+ * \brief Iterate over frames decoded in parallel
+ *
+ * Like ufo_decoder_get_next_frame but several frames are decoded at once as
+ * set with ufo_decoder_set_frames_ahead. Frames are still returned one by one
+ * in stream order. Do not mix calls with ufo_decoder_get_next_frame on the
+ * same raw data. Pixels that are not part of a corrupt frame keep whatever an
+ * earlier frame decoded into the same buffer left there.
+ *
+ * \param decoder An UfoDecoder instance
+ * \param pixels Location for a pointer to the decoded frame. The buffer is
+ * owned by the decoder and valid until the next call.
+ * \param meta Location for the meta data of the frame
+ *
+ * \return 0 in case of no error, EIO if end of stream was reached, ENOMEM if
+ * no frame buffers could be allocated and EILSEQ if data stream is corrupt.
+ */
+int
+ufo_decoder_get_next_frame_buffer (UfoDecoder *decoder, uint16_t **pixels, UfoDecoderMeta *meta)
+{
+    const UfoFrameSlot *slot;
+    int err;
+
+    if (pixels == NULL)
+        return 0;
+
+    if (decoder->slots == NULL && (err = ufo_decoder_set_frames_ahead (decoder, 1)))
+        return err;
+
+    if (decoder->next_slot == decoder->num_ready && (err = ufo_decoder_decode_frames_ahead (decoder)))
+        return err;
+
+    slot = &decoder->slots[decoder->next_slot++];
+    *pixels = slot->pixels;
+    *meta = slot->meta;
+
+    if (!slot->advance)
+        return EILSEQ;
+
+    return 0;
+}
+
+/**
+ * \brief Decode several frames at once
+ *
+ * Like calling ufo_decoder_get_next_frame num_frames times, but frames are
+ * decoded into the given buffers without any allocation and, with more than
+ * one thread set with ufo_decoder_set_num_threads, several frames are decoded
+ * in parallel. Decoding stops after the first corrupt frame. Do not mix calls
+ * with ufo_decoder_get_next_frame_buffer on the same raw data.
+ *
+ * \param decoder An UfoDecoder instance
+ * \param pixels Array of num_frames buffers, each large enough for a frame
+ * \param meta Array of num_frames locations for the meta data of the frames
+ * \param num_frames Maximum number of frames to decode
+ * \param num_decoded Location for the number of frames written to pixels and
+ * meta, including a corrupt last one
+ *
+ * \return 0 if num_frames frames were decoded, EIO if end of stream was
+ * reached before, EILSEQ if the last decoded frame is corrupt and EFAULT if
+ * pixels or one of the buffers is a NULL-pointer.
+ */
+int
+ufo_decoder_get_next_frames (UfoDecoder *decoder, uint16_t **pixels, UfoDecoderMeta *meta, size_t num_frames,
+                             size_t *num_decoded)
+{
+    UfoFrameSlot slots[IPECAMERA_MAX_BATCH];
+    size_t batch_size = 1;
+    size_t n = 0;
+    int err = 0;
+
+    *num_decoded = 0;
+
+    if (pixels == NULL || meta == NULL)
+        return EFAULT;
+
+    for (size_t i = 0; i < num_frames; i++) {
+        if (pixels[i] == NULL)
+            return EFAULT;
+    }
+
+    if (decoder->pool != NULL)
+        batch_size = ufo_thread_pool_get_num_threads (decoder->pool);
+
+    if (batch_size > IPECAMERA_MAX_BATCH)
+        batch_size = IPECAMERA_MAX_BATCH;
+
+    while (n < num_frames && !err) {
+        const size_t num_slots = num_frames - n < batch_size ? num_frames - n : batch_size;
+        size_t num_ready;
+
+        for (size_t i = 0; i < num_slots; i++)
+            slots[i].pixels = pixels[n + i];
+
+        num_ready = ufo_decoder_decode_batch (decoder, slots, num_slots);
+
+        if (num_ready == 0) {
+            err = EIO;
+            break;
+        }
+
+        for (size_t i = 0; i < num_ready; i++)
+            meta[n++] = slots[i].meta;
+
+        /* Batches end with the first corrupt frame */
+        if (!slots[num_ready - 1].advance)
+            err = EILSEQ;
+    }
+
+    *num_decoded = n;
+    return err;
+}
+
+static inline size_t
+ufo_segment_words (const UfoSegment *segment)
+{
+    return segment->num_bytes / 4;
+}
+
+static void
+ufo_cursor_advance (const UfoSegment *segments, size_t num_segments, UfoCursor *cursor, size_t num_words)
+{
+    cursor->offset += num_words;
+
+    while ((cursor->segment < num_segments) && (cursor->offset >= ufo_segment_words (&segments[cursor->segment]))) {
+        cursor->offset -= ufo_segment_words (&segments[cursor->segment]);
+        cursor->segment++;
+    }
+}
+
+static inline uint32_t
+ufo_cursor_word (const UfoSegment *segments, const UfoCursor *cursor)
+{
+    return segments[cursor->segment].raw[cursor->offset];
+}
+
+/*
+ * Copy up to num_words words starting at cursor into words and return how many
+ * there were.
+ */
+static size_t
+ufo_cursor_copy (const UfoSegment *segments, size_t num_segments, UfoCursor cursor, uint32_t *words, size_t num_words)
+{
+    size_t i;
+
+    for (i = 0; (i < num_words) && (cursor.segment < num_segments); i++) {
+        words[i] = ufo_cursor_word (segments, &cursor);
+        ufo_cursor_advance (segments, num_segments, &cursor, 1);
+    }
+
+    return i;
+}
+
+/*
+ * Decode the payload starting at cursor and move the cursor to its end. Runs
+ * of whole blocks are decoded in place. A block that crosses the end of a
+ * segment is copied out together with the word following it, which the v6
+ * decoder looks at to skip 0xC0 blocks.
+ */
+static size_t
+ufo_decode_payload_segments (UfoDecoder *decoder, uint16_t *pixels, const UfoSegment *segments, size_t num_segments,
+                             UfoCursor *cursor, int dataformat_version, const UfoDecoderMeta *meta)
+{
+    size_t total = 0;
+    size_t off = 0;
+
+    while (cursor->segment < num_segments) {
+        const size_t num_words = ufo_segment_words (&segments[cursor->segment]) - cursor->offset;
+        uint32_t block[17] = {0};
+        uint32_t *raw;
+        size_t limit;
+        size_t base;
+
+        if (num_words > 8) {
+            raw = segments[cursor->segment].raw + cursor->offset;
+            limit = (num_words - 1) / 8 * 8;
+        }
+        else {
+            if (ufo_cursor_copy (segments, num_segments, *cursor, block, 17) < 8)
+                break;
+
+            raw = block;
+            limit = 8;
+        }
+
+        if (dataformat_version == 5)
+            base = ufo_decode_frame_channels_v5 (decoder, pixels, raw, limit * 4, ufo_decoder_get_num_rows (decoder),
+                                                 meta->output_mode, &off);
+        else
+            base = ufo_decode_frame_channels_v6 (decoder, pixels, raw, limit * 4, ufo_decoder_get_num_rows (decoder),
+                                                 meta->cmosis_start_address, meta->adc_resolution);
+
+        ufo_cursor_advance (segments, num_segments, cursor, base);
+        total += base;
+
+        /* Stopped at the footer */
+        if (base < limit)
+            break;
+    }
+
+    return total;
+}
+
+/*
+ * Move cursor to the first frame after it that has a footer before the next
+ * frame header or to the end of the segments if there is none, just like
+ * ufo_decoder_find_valid_frame. Returns the number of words passed.
+ */
+static size_t
+ufo_cursor_find_valid_frame (UfoDecoder *decoder, const UfoSegment *segments, size_t num_segments, UfoCursor *cursor)
+{
+    UfoCursor pos = *cursor;
+    UfoCursor start = pos;
+    size_t num_passed = 0;
+    size_t num_start = SIZE_MAX;
+    uint32_t words[8];
+
+    while (pos.segment < num_segments) {
+        const size_t num_left = ufo_segment_words (&segments[pos.segment]) - pos.offset;
+        const size_t skip = decoder->find_marker (segments[pos.segment].raw + pos.offset, num_left);
+
+        ufo_cursor_advance (segments, num_segments, &pos, skip);
+        num_passed += skip;
+
+        /* No marker in the rest of this segment */
+        if (skip == num_left)
+            continue;
+
+        if (ufo_cursor_copy (segments, num_segments, pos, words, 8) < 8)
+            break;
+
+        if (ufo_is_frame_header (words)) {
+            start = pos;
+            num_start = num_passed;
+            ufo_cursor_advance (segments, num_segments, &pos, 8);
+            num_passed += 8;
+            continue;
+        }
+
+        if ((num_start != SIZE_MAX) && (words[0] == 0x0AAAAAAA) && (words[7] == 0x01111111)) {
+            *cursor = start;
+            return num_start;
+        }
+
+        ufo_cursor_advance (segments, num_segments, &pos, 1);
+        num_passed++;
+    }
+
+    while (pos.segment < num_segments) {
+        const size_t num_left = ufo_segment_words (&segments[pos.segment]) - pos.offset;
+
+        ufo_cursor_advance (segments, num_segments, &pos, num_left);
+        num_passed += num_left;
+    }
+
+    *cursor = pos;
+    return num_passed;
+}
+
+/*
+ * Decode the frame at cursor and move the cursor past it. Returns the number
+ * of words of the frame or 0 on error, just like ufo_decode_frame.
+ */
+static size_t
+ufo_decode_frame_segments (UfoDecoder *decoder, const UfoSegment *segments, size_t num_segments, UfoCursor *cursor,
+                           uint16_t *pixels, UfoDecoderMeta *meta)
+{
+    UfoDecoderStats *stats = &decoder->stats;
+    uint32_t words[8];
+    int dataformat_version;
+    size_t advance = 0;
+    uint64_t start_time;
+    uint64_t payload_time;
+    int err;
+
+    if ((pixels == NULL) || (ufo_cursor_copy (segments, num_segments, *cursor, words, 8) < 8))
+        return 0;
+
+    start_time = ufo_decoder_now (decoder);
+    err = ufo_decode_header (words, meta, &dataformat_version);
+    ufo_cursor_advance (segments, num_segments, cursor, 8);
+    payload_time = ufo_decoder_now (decoder);
+    stats->header_ns += payload_time - start_time;
+
+    /* Do not waste time on the payload of a frame that is rejected anyway */
+    if (err) {
+        ufo_decoder_count_frame (decoder, 0);
+        return 0;
+    }
+
+    if ((dataformat_version == 5) || (dataformat_version == 6))
+        advance = ufo_decode_payload_segments (decoder, pixels, segments, num_segments, cursor, dataformat_version, meta);
+    else
+        fprintf (stderr, "Data format version %i unsupported\n", dataformat_version);
+
+    start_time = ufo_decoder_now (decoder);
+    stats->payload_ns += start_time - payload_time;
+
+    if (ufo_cursor_copy (segments, num_segments, *cursor, words, 8) < 8) {
+        ufo_decoder_count_frame (decoder, 0);
+        return 0;
+    }
+
+    err = ufo_decode_footer (words, meta);
+    ufo_cursor_advance (segments, num_segments, cursor, 8);
+    stats->header_ns += ufo_decoder_now (decoder) - start_time;
+
+    advance = err ? 0 : advance + 16;
+    ufo_decoder_count_frame (decoder, advance);
+    return advance;
+}
+
+/**
+ * \brief Decode frame stored in several segments
+ *
+ * Like ufo_decoder_decode_frame but the frame is spread over a list of
+ * segments, e.g. when it wraps around the end of a DMA ring buffer. Each
+ * segment must hold whole words. Blocks crossing the end of a segment are
+ * handled without copying the whole frame into one buffer. The payload is
+ * decoded by the calling thread only.
+ *
+ * \param decoder An UfoDecoder instance
+ * \param segments Segments that make up the data stream, starting with the
+ * frame
+ * \param num_segments Number of segments
+ * \param pixels Buffer for the decoded frame
+ * \param meta Location for the meta data of the frame
+ *
+ * \return number of decoded words or 0 in case of error
+ */
+size_t
+ufo_decoder_decode_frame_segments (UfoDecoder *decoder, const UfoSegment *segments, size_t num_segments,
+                                   uint16_t *pixels, UfoDecoderMeta *meta)
+{
+    UfoCursor cursor = { 0, 0 };
+
+    ufo_cursor_advance (segments, num_segments, &cursor, 0);
+    return ufo_decode_frame_segments (decoder, segments, num_segments, &cursor, pixels, meta);
+}
+
+/**
+ * \brief Iterate and decode next frame stored in several segments
+ *
+ * Like ufo_decoder_get_next_frame but the data stream is given as a list of
+ * segments and the position in it is kept in cursor, which should be zeroed
+ * before the first call.
+ *
+ * \param decoder An UfoDecoder instance
+ * \param segments Segments that make up the data stream
+ * \param num_segments Number of segments
+ * \param cursor Position in the segments, moved past the frame
+ * \param pixels If pointer with NULL content is passed, a new buffer is
+ * allocated otherwise, this user-supplied buffer is used.
+ * \param meta Location for the meta data of the frame
+ *
+ * \return 0 in case of no error, EIO if end of stream was reached, ENOMEM if
+ * NULL was passed but no memory could be allocated and EILSEQ if data stream
+ * is corrupt.
+ */
+int
+ufo_decoder_get_next_frame_segments (UfoDecoder *decoder, const UfoSegment *segments, size_t num_segments,
+                                     UfoCursor *cursor, uint16_t **pixels, UfoDecoderMeta *meta)
+{
+    size_t num_words = 0;
+    UfoCursor start;
+    size_t advance;
+    uint64_t scan_time;
+
+    if (pixels == NULL)
+        return 0;
+
+    ufo_cursor_advance (segments, num_segments, cursor, 0);
+
+    if (cursor->segment < num_segments)
+        num_words = ufo_segment_words (&segments[cursor->segment]) - cursor->offset;
+
+    for (size_t i = cursor->segment + 1; (i < num_segments) && (num_words < 4096); i++)
+        num_words += ufo_segment_words (&segments[i]);
+
+    if (num_words < 4096)
+        return EIO;
+
+    if (*pixels == NULL) {
+        *pixels = ufo_decoder_alloc_frame (decoder);
+
+        if (*pixels == NULL)
+            return ENOMEM;
+    }
+
+    scan_time = ufo_decoder_now (decoder);
+
+    while ((cursor->segment < num_segments) &&
+           ((ufo_cursor_word (segments, cursor) & 0xFFFFFFF0) != 0x51111110)) {
+        const size_t num_left = ufo_segment_words (&segments[cursor->segment]) - cursor->offset;
+        const size_t skip = decoder->find_marker (segments[cursor->segment].raw + cursor->offset, num_left);
+
+        ufo_cursor_advance (segments, num_segments, cursor, skip > 0 ? skip : 1);
+        ufo_decoder_count_skipped (decoder, skip > 0 ? skip : 1, 0);
+    }
+
+    decoder->stats.scan_ns += ufo_decoder_now (decoder) - scan_time;
+
+    if (cursor->segment == num_segments)
+        return EIO;
+
+    start = *cursor;
+    advance = ufo_decode_frame_segments (decoder, segments, num_segments, cursor, *pixels, meta);
+    scan_time = ufo_decoder_now (decoder);
+
+    /*
+     * On error, continue with the next frame that looks complete instead of
+     * trying every frame header in the damaged part.
+     */
+    if (!advance) {
+        *cursor = start;
+        ufo_cursor_advance (segments, num_segments, cursor, 1);
+        ufo_decoder_count_skipped (decoder, 1 + ufo_cursor_find_valid_frame (decoder, segments, num_segments, cursor), 0);
+    }
+
+    /* if words left and we see fill words, skip them */
+    if (cursor->segment < num_segments) {
+        uint32_t words[3];
+
+        if ((ufo_cursor_copy (segments, num_segments, *cursor, words, 3) == 3) &&
+            (words[0] == 0x0) && ((words[1] == 0x1111111) || (words[1] == 0x0))) {
+            size_t num_fill = 2;
+
+            ufo_cursor_advance (segments, num_segments, cursor, 2);
+
+            for (; (cursor->segment < num_segments) && ufo_is_fill_word (ufo_cursor_word (segments, cursor)); num_fill++)
+                ufo_cursor_advance (segments, num_segments, cursor, 1);
+
+            ufo_decoder_count_skipped (decoder, 0, num_fill);
+        }
+    }
+
+    decoder->stats.scan_ns += ufo_decoder_now (decoder) - scan_time;
+
+    if (!advance)
+        return EILSEQ;
+
+    return 0;
+}
+
+static const char ufo_frame_index_magic[8] = "UFOIDX1";
+
+/*
+ * Read the header and footer of the frame at start into meta without decoding
+ * the payload, whose size of the previous frame is passed in payload_words and
+ * updated. Returns the number of words of the frame or 0 if it is corrupt or
+ * cut off at the end of the data.
+ */
+static size_t
+ufo_decoder_read_meta (UfoDecoder *decoder, size_t start, UfoDecoderMeta *meta, size_t *payload_words)
+{
+    const uint32_t *raw = decoder->raw;
+    const size_t num_words = decoder->num_bytes / 4;
+    int dataformat_version;
+    size_t advance = 0;
+    int err;
+
+    err = ufo_decode_header (raw + start, meta, &dataformat_version);
+
+    if ((dataformat_version == 5) || (dataformat_version == 6))
+        advance = ufo_find_payload_end (raw + start + 8, num_words - start - 8, *payload_words);
+
+    if ((start + 16 + advance) > num_words)
+        return 0;
+
+    err |= ufo_decode_footer (raw + start + 8 + advance, meta);
+
+    if (err)
+        return 0;
+
+    *payload_words = advance;
+    return advance + 16;
+}
+
+/**
+ * \brief Iterate over the meta data of frames
+ *
+ * Like ufo_decoder_get_next_frame but only the header and footer of the next
+ * frame are read, the payload is skipped without decoding it. This is much
+ * faster when only frame numbers, time stamps or status words are of
+ * interest. The payload is not checked, so frames whose payload is damaged
+ * but have an intact header and footer are not reported as corrupt.
+ *
+ * \param decoder An UfoDecoder instance
+ * \param meta Location for the meta data of the frame
+ *
+ * \return 0 in case of no error, EIO if end of stream was reached and EILSEQ
+ * if data stream is corrupt.
+ */
+int
+ufo_decoder_get_next_meta (UfoDecoder *decoder, UfoDecoderMeta *meta)
+{
+    const size_t pos = decoder->current_pos;
+    size_t start;
+    size_t advance;
+    uint64_t scan_time;
+    uint64_t header_time;
+
+    scan_time = ufo_decoder_now (decoder);
+    start = ufo_decoder_find_frame (decoder, pos);
+    header_time = ufo_decoder_now (decoder);
+    decoder->stats.scan_ns += header_time - scan_time;
+
+    if (start == SIZE_MAX)
+        return EIO;
+
+    advance = ufo_decoder_read_meta (decoder, start, meta, &decoder->payload_words);
+
+    scan_time = ufo_decoder_now (decoder);
+    decoder->stats.header_ns += scan_time - header_time;
+    decoder->current_pos = ufo_decoder_skip_frame (decoder, start, advance);
+    decoder->stats.scan_ns += ufo_decoder_now (decoder) - scan_time;
+
+    ufo_decoder_count_span (decoder, pos, start, advance, decoder->current_pos);
+
+    if (!advance)
+        return EILSEQ;
+
+    return 0;
+}
+
+/**
+ * \brief Build an index of the frames in the raw data
+ *
+ * Walks the raw data stream set on the decoder and records where each frame
+ * starts that ufo_decoder_get_next_frame would come across, including corrupt
+ * ones. Only headers and footers are read, pixels are not decoded. The
+ * current position of the decoder is not changed.
+ *
+ * \param decoder An UfoDecoder instance
+ *
+ * \return A new index that must be released with ufo_frame_index_free or NULL
+ * if no memory could be allocated.
+ */
+UfoFrameIndex *
+ufo_decoder_build_index (UfoDecoder *decoder)
+{
+    UfoFrameIndex *index;
+    size_t capacity = 64;
+    size_t payload_words = 0;
+    size_t pos = 0;
+    size_t start;
+
+    index = malloc (sizeof (UfoFrameIndex));
+
+    if (index == NULL)
+        return NULL;
+
+    index->num_frames = 0;
+    index->frames = malloc (capacity * sizeof (UfoFrameIndexEntry));
+
+    if (index->frames == NULL) {
+        free (index);
+        return NULL;
+    }
+
+    while ((start = ufo_decoder_find_frame (decoder, pos)) != SIZE_MAX) {
+        UfoDecoderMeta meta = {0};
+        UfoFrameIndexEntry *entry;
+        size_t advance;
+
+        if (index->num_frames == capacity) {
+            UfoFrameIndexEntry *frames = realloc (index->frames, 2 * capacity * sizeof (UfoFrameIndexEntry));
+
+            if (frames == NULL) {
+                ufo_frame_index_free (index);
+                return NULL;
+            }
+
+            index->frames = frames;
+            capacity *= 2;
+        }
+
+        advance = ufo_decoder_read_meta (decoder, start, &meta, &payload_words);
+
+        entry = &index->frames[index->num_frames++];
+        entry->offset = start;
+        entry->frame_number = meta.frame_number;
+        entry->time_stamp = meta.time_stamp;
+
+        pos = ufo_decoder_skip_frame (decoder, start, advance);
+    }
+
+    return index;
+}
+
+/**
+ * \brief Release frame index
+ *
+ * \param index An UfoFrameIndex
+ */
+void
+ufo_frame_index_free (UfoFrameIndex *index)
+{
+    if (index == NULL)
+        return;
+
+    free (index->frames);
+    free (index);
+}
+
+/**
+ * \brief Write frame index to a file
+ *
+ * The entries are stored in host byte order.
+ *
+ * \param index An UfoFrameIndex
+ * \param filename Name of the file
+ *
+ * \return 0 in case of no error or errno if writing failed.
+ */
+int
+ufo_frame_index_save (const UfoFrameIndex *index, const char *filename)
+{
+    const uint64_t num_frames = index->num_frames;
+    FILE *fp = fopen (filename, "wb");
+    int err = 0;
+
+    if (fp == NULL)
+        return errno;
+
+    if ((fwrite (ufo_frame_index_magic, sizeof (ufo_frame_index_magic), 1, fp) != 1) ||
+        (fwrite (&num_frames, sizeof (num_frames), 1, fp) != 1) ||
+        (fwrite (index->frames, sizeof (UfoFrameIndexEntry), index->num_frames, fp) != index->num_frames))
+        err = errno ? errno : EIO;
+
+    if (fclose (fp) && !err)
+        err = errno;
+
+    return err;
+}
+
+/**
+ * \brief Read frame index from a file
+ *
+ * \param filename Name of a file written by ufo_frame_index_save
+ *
+ * \return A new index that must be released with ufo_frame_index_free or NULL
+ * if the file could not be read.
+ */
+UfoFrameIndex *
+ufo_frame_index_load (const char *filename)
+{
+    char magic[sizeof (ufo_frame_index_magic)];
+    uint64_t num_frames;
+    UfoFrameIndex *index;
+    FILE *fp = fopen (filename, "rb");
+
+    if (fp == NULL)
+        return NULL;
+
+    if ((fread (magic, sizeof (magic), 1, fp) != 1) ||
+        memcmp (magic, ufo_frame_index_magic, sizeof (magic)) ||
+        (fread (&num_frames, sizeof (num_frames), 1, fp) != 1) ||
+        (num_frames > SIZE_MAX / sizeof (UfoFrameIndexEntry))) {
+        fclose (fp);
+        return NULL;
+    }
+
+    index = malloc (sizeof (UfoFrameIndex));
+
+    if (index == NULL) {
+        fclose (fp);
+        return NULL;
+    }
+
+    index->num_frames = num_frames;
+    index->frames = malloc ((num_frames > 0 ? num_frames : 1) * sizeof (UfoFrameIndexEntry));
+
+    if ((index->frames == NULL) ||
+        (fread (index->frames, sizeof (UfoFrameIndexEntry), num_frames, fp) != num_frames)) {
+        ufo_frame_index_free (index);
+        index = NULL;
+    }
+
+    fclose (fp);
+    return index;
+}
+
+/**
+ * \brief Move to a frame of the index
+ *
+ * The next call to ufo_decoder_get_next_frame or
+ * ufo_decoder_get_next_frame_buffer decodes the given frame. The index must
+ * have been built for the raw data that is currently set.
+ *
+ * \param decoder An UfoDecoder instance
+ * \param index An UfoFrameIndex
+ * \param frame Position of the frame in the index
+ *
+ * \return 0 in case of no error, EINVAL if frame is not in the index or not in
+ * the raw data.
+ */
+int
+ufo_decoder_seek (UfoDecoder *decoder, const UfoFrameIndex *index, size_t frame)
+{
+    if ((frame >= index->num_frames) || (index->frames[frame].offset >= decoder->num_bytes / 4))
+        return EINVAL;
+
+    decoder->current_pos = index->frames[frame].offset;
+    decoder->num_ready = 0;
+    decoder->next_slot = 0;
+    return 0;
+}
+
+static int
+ufo_stream_append (UfoStream *stream, const void *data, size_t num_bytes)
+{
+    /* Nothing to keep, data may be NULL */
+    if (num_bytes == 0)
+        return 0;
+
+    if (stream->carry_bytes + num_bytes > stream->carry_size) {
+        size_t size = stream->carry_size > 0 ? stream->carry_size : 4096;
+        uint32_t *carry;
+
+        while (size < stream->carry_bytes + num_bytes)
+            size *= 2;
+
+        carry = realloc (stream->carry, size);
+
+        if (carry == NULL)
+            return ENOMEM;
+
+        stream->carry = carry;
+        stream->carry_size = size;
+    }
+
+    memcpy ((uint8_t *) stream->carry + stream->carry_bytes, data, num_bytes);
+    stream->carry_bytes += num_bytes;
+    return 0;
+}
+
+static inline uint32_t
+ufo_stream_word (const UfoStream *stream, size_t pos)
+{
+    const size_t num_carry = stream->carry_bytes / 4;
+    return pos < num_carry ? stream->carry[pos] : stream->chunk[pos - num_carry];
+}
+
+/**
+ * \brief Add data to the stream
+ *
+ * Instead of setting the whole data stream with ufo_decoder_set_raw_data,
+ * it can be passed in chunks of any size as it arrives. After each chunk, call
+ * ufo_decoder_pop_frame until it returns EAGAIN. Frames are decoded directly
+ * from the chunks, only the part of a frame that is not complete at the end
+ * of a chunk is copied and kept by the decoder.
+ *
+ * \param decoder An UfoDecoder instance
+ * \param raw Next part of the data stream. It must stay valid until the next
+ * call to ufo_decoder_push_data.
+ * \param num_bytes Size of the part in bytes
+ *
+ * \return 0 in case of no error, ENOMEM if the remainder of the previous part
+ * could not be kept.
+ */
+int
+ufo_decoder_push_data (UfoDecoder *decoder, const uint32_t *raw, size_t num_bytes)
+{
+    UfoStream *stream = &decoder->stream;
+    const size_t pos_bytes = stream->pos * 4;
+    int err;
+
+    /* Keep what has not been decoded yet */
+    if (pos_bytes < stream->carry_bytes) {
+        memmove (stream->carry, (uint8_t *) stream->carry + pos_bytes, stream->carry_bytes - pos_bytes);
+        stream->carry_bytes -= pos_bytes;
+        err = ufo_stream_append (stream, stream->chunk, stream->chunk_bytes);
+    }
+    else {
+        const size_t chunk_pos = pos_bytes - stream->carry_bytes;
+
+        stream->carry_bytes = 0;
+        err = 0;
+
+        /* The previous chunk may have been decoded completely or be the first */
+        if (chunk_pos < stream->chunk_bytes)
+            err = ufo_stream_append (stream, (const uint8_t *) stream->chunk + chunk_pos, stream->chunk_bytes - chunk_pos);
+    }
+
+    stream->chunk = NULL;
+    stream->chunk_bytes = 0;
+    stream->pos = 0;
+
+    if (err)
+        return err;
+
+    /* Words of a chunk following a partial word cannot be accessed in place */
+    if (stream->carry_bytes % 4)
+        return ufo_stream_append (stream, raw, num_bytes);
+
+    stream->chunk = raw;
+    stream->chunk_bytes = num_bytes;
+    return 0;
+}
+
+/**
+ * \brief Decode next complete frame of the stream
+ *
+ * Decodes the next frame of the data passed with ufo_decoder_push_data once
+ * all of it has arrived.
+ *
+ * \param decoder An UfoDecoder instance
+ * \param pixels If pointer with NULL content is passed, a new buffer is
+ * allocated otherwise, this user-supplied buffer is used.
+ * \param meta Location for the meta data of the frame
+ *
+ * \return 0 in case of no error, EAGAIN if more data is needed, ENOMEM if
+ * memory could not be allocated and EILSEQ if data stream is corrupt.
+ */
+int
+ufo_decoder_pop_frame (UfoDecoder *decoder, uint16_t **pixels, UfoDecoderMeta *meta)
+{
+    /* Even in 4 channel mode a frame of the largest size is way smaller */
+    const size_t max_payload_words = 4 * IPECAMERA_MAX_ROWS * (size_t) decoder->width;
+    UfoStream *stream = &decoder->stream;
+    size_t num_carry = stream->carry_bytes / 4;
+    const size_t num_words = num_carry + stream->chunk_bytes / 4;
+    uint32_t header[8];
+    uint32_t *raw;
+    int dataformat_version;
+    size_t start;
+    size_t end;
+    size_t advance;
+    uint64_t scan_time;
+
+    if (pixels == NULL)
+        return 0;
+
+    scan_time = ufo_decoder_now (decoder);
+    start = stream->pos;
+
+    while ((stream->pos < num_words) &&
+           ((ufo_stream_word (stream, stream->pos) & 0xFFFFFFF0) != 0x51111110)) {
+        if (stream->pos >= num_carry)
+            stream->pos += decoder->find_marker (stream->chunk + stream->pos - num_carry, num_words - stream->pos);
+
+        if ((stream->pos < num_words) && ((ufo_stream_word (stream, stream->pos) & 0xFFFFFFF0) != 0x51111110))
+            stream->pos++;
+    }
+
+    ufo_decoder_count_skipped (decoder, stream->pos - start, 0);
+    start = stream->pos;
+
+    if ((start + 8) > num_words) {
+        decoder->stats.scan_ns += ufo_decoder_now (decoder) - scan_time;
+        return EAGAIN;
+    }
+
+    for (size_t i = 0; i < 8; i++)
+        header[i] = ufo_stream_word (stream, start + i);
+
+    ufo_decode_header (header, meta, &dataformat_version);
+    end = start + 8;
+
+    if ((dataformat_version == 5) || (dataformat_version == 6)) {
+        if (start >= num_carry) {
+            end += ufo_find_payload_end (stream->chunk + end - num_carry, num_words - end, decoder->payload_words);
+        }
+        else {
+            while (((end + 8) <= num_words) && (ufo_stream_word (stream, end) != 0xAAAAAAA) &&
+                   !(((ufo_stream_word (stream, end) & 0xFFFFFFF0) == 0x51111110) &&
+                     (ufo_stream_word (stream, end + 1) == 0x52222222)) &&
+                   ((end - start - 8) <= max_payload_words))
+                end += 8;
+        }
+
+        if ((end - start - 8) > max_payload_words) {
+            stream->pos = start + 1;
+            ufo_decoder_count_skipped (decoder, 1, 0);
+            ufo_decoder_count_frame (decoder, 0);
+            decoder->stats.scan_ns += ufo_decoder_now (decoder) - scan_time;
+            return EILSEQ;
+        }
+    }
+
+    end += 8;
+    decoder->stats.scan_ns += ufo_decoder_now (decoder) - scan_time;
+
+    if (end > num_words)
+        return EAGAIN;
+
+    if (*pixels == NULL) {
+        *pixels = ufo_decoder_alloc_frame (decoder);
+
+        if (*pixels == NULL)
+            return ENOMEM;
+    }
+
+    if (start >= num_carry) {
+        raw = (uint32_t *) stream->chunk + start - num_carry;
+    }
+    else {
+        /* Move the part of the frame in the current chunk over */
+        if (end > num_carry) {
+            const size_t num_bytes = (end - num_carry) * 4;
+
+            if (ufo_stream_append (stream, stream->chunk, num_bytes))
+                return ENOMEM;
+
+            stream->chunk += end - num_carry;
+            stream->chunk_bytes -= num_bytes;
+            num_carry = end;
+        }
+
+        raw = stream->carry + start;
+    }
+
+    advance = ufo_decode_frame (decoder, raw, (end - start) * 4, *pixels, meta, true, &decoder->stats);
+    stream->pos = start + (advance == 0 ? 1 : advance);
+    ufo_decoder_count_skipped (decoder, advance == 0 ? 1 : 0, 0);
+    ufo_decoder_count_frame (decoder, advance);
+
+    if ((stream->pos >= num_carry) && ((stream->carry_bytes % 4) == 0)) {
+        stream->pos -= num_carry;
+        stream->carry_bytes = 0;
+    }
+
+    if (!advance)
+        return EILSEQ;
+
+    return 0;
+}
+
+static void
+ufo_convert_bayer_row (const uint16_t *row, uint8_t *out, int width, int y, uint32_t max, uint32_t factor)
+{
+    for (int x = 1; x < width - 1; x++)
+        ufo_convert_bayer_pixel (row, out, width, x, y, max, factor);
+}
+
+/*
+ * Pick the Bayer conversion kernel the same way as the payload kernels.
+ */
+static UfoBayerRowFunc
+ufo_select_bayer_kernel (void)
+{
+#ifdef HAVE_AVX2
+    if (ufo_use_avx2 ())
+        return ufo_convert_bayer_row_avx2;
+#endif
+
+    return ufo_convert_bayer_row;
+}
+
+typedef struct {
+    const uint16_t     *in;
+    size_t              num_pixels;
+    size_t              num_bands;
+    uint16_t           *maxima;         /**< Maximum of each band */
+} UfoMaxJob;
+
+static void
+ufo_find_band_max (void *data, size_t index)
+{
+    UfoMaxJob *job = (UfoMaxJob *) data;
+    const size_t start = job->num_pixels * index / job->num_bands;
+    const size_t end = job->num_pixels * (index + 1) / job->num_bands;
+    uint16_t max = 0;
+
+    for (size_t i = start; i < end; i++) {
+        if (max < job->in[i])
+            max = job->in[i];
+    }
+
+    job->maxima[index] = max;
+}
+
+/*
+ * Brightest pixel of a frame, at least 1 so that it can be divided by.
+ */
+static uint16_t
+ufo_find_max (UfoThreadPool *pool, const uint16_t *in, size_t num_pixels)
+{
+    const size_t num_bands = pool != NULL ? ufo_thread_pool_get_num_threads (pool) : 1;
+    uint16_t maxima[num_bands];
+    uint16_t max = 1;
+    UfoMaxJob job;
+
+    job.in = in;
+    job.num_pixels = num_pixels;
+    job.num_bands = num_bands;
+    job.maxima = maxima;
+    ufo_run_bands (pool, ufo_find_band_max, &job, num_bands);
+
+    for (size_t i = 0; i < num_bands; i++) {
+        if (max < maxima[i])
+            max = maxima[i];
+    }
+
+    return max;
+}
+
+typedef struct {
+    const uint16_t     *in;
+    uint8_t            *out;
+    int                 width;
+    int                 height;
+    uint32_t            max;
+    uint32_t            factor;
+    UfoBayerRowFunc     convert_row;
+    size_t              num_bands;
+} UfoBayerJob;
+
+static void
+ufo_bayer_band (const UfoBayerJob *job, size_t index, int *first, int *last)
+{
+    const size_t num_rows = job->height - 2;
+
+    *first = 1 + (int) (num_rows * index / job->num_bands);
+    *last = 1 + (int) (num_rows * (index + 1) / job->num_bands);
+}
+
+static void
+ufo_convert_bayer_band (void *data, size_t index)
+{
+    UfoBayerJob *job = (UfoBayerJob *) data;
+    int first, last;
+
+    ufo_bayer_band (job, index, &first, &last);
+
+    for (int y = first; y < last; y++) {
+        const size_t offset = (size_t) y * job->width;
+
+        job->convert_row (job->in + offset, job->out + 3 * offset, job->width, y, job->max, job->factor);
+    }
+}
+
+static void
+ufo_convert_bayer (UfoThreadPool *pool, const uint16_t *in, uint8_t *out, int width, int height, uint16_t max)
+{
+    const size_t num_bands = pool != NULL ? ufo_thread_pool_get_num_threads (pool) : 1;
+    UfoBayerJob job;
+
+    if (width < 3 || height < 3)
+        return;
+
+    if (max == 0)
+        max = ufo_find_max (pool, in, (size_t) width * height);
+
+    job.in = in;
+    job.out = out;
+    job.width = width;
+    job.height = height;
+    job.convert_row = ufo_select_bayer_kernel ();
+    job.num_bands = num_bands;
+    job.max = max;
+    job.factor = ufo_bayer_factor (max);
+    ufo_run_bands (pool, ufo_convert_bayer_band, &job, num_bands);
+}
+
+/**
+ * \brief Convert Bayer pattern to RGB
+ *
+ * Convert Bayer pattern to RGB via bilinear interpolation. The brightest
+ * pixel of the frame is mapped to 255. The one pixel wide border of the output
+ * is not touched.
+ *
+ * \param in 16 bit input data in Bayer pattern format
+ * \param out Location for 24 bit output data in RGB format. At
+ * least width x height x 3 bytes must be allocated.
+ * \param width Width of a frame
+ * \param height Height of a frame
+ */
+void
+ufo_convert_bayer_to_rgb (const uint16_t *in, uint8_t *out, int width, int height)
+{
+    ufo_convert_bayer (NULL, in, out, width, height, 0);
+}
 
-                CHECK_VALUE (header->magic_2, 0x52222222);
-                CHECK_VALUE (header->magic_3, 0x53333333);
-                CHECK_VALUE (header->magic_4, 0x54444444);
-                CHECK_VALUE (header->magic_5, 0x55555555);
+/**
+ * \brief Convert Bayer pattern to RGB with the threads of a decoder
+ *
+ * Same as ufo_convert_bayer_to_rgb, but the frame is split into bands of rows
+ * that are converted by the threads set up with ufo_decoder_set_num_threads.
+ * Passing the maximum value avoids looking for it in the frame first.
+ *
+ * \param decoder An UfoDecoder instance
+ * \param in 16 bit input data in Bayer pattern format
+ * \param out Location for 24 bit output data in RGB format. At
+ * least width x height x 3 bytes must be allocated.
+ * \param width Width of a frame
+ * \param height Height of a frame
+ * \param max Input value that is mapped to 255, larger ones are clamped. 0
+ * uses the brightest pixel of the frame.
+ */
+void
+ufo_decoder_convert_bayer_to_rgb (UfoDecoder *decoder, const uint16_t *in, uint8_t *out, int width, int height,
+                                  uint16_t max)
+{
+    ufo_convert_bayer (decoder->pool, in, out, width, height, max);
+}
 
-                CHECK_VALUE (header->five_1, 0x5);
-                CHECK_VALUE (header->five_2, 0x5);
+/**
+ * \brief Create a pipeline of processing stages
+ *
+ * A pipeline runs a chain of stages on decoded frames. The frame is cut into
+ * tiles of a few rows that go through all stages before the next tile is
+ * started, so that the intermediate results stay in the cache. Tiles are
+ * processed by the threads set up with ufo_decoder_set_num_threads.
+ *
+ * \param decoder An UfoDecoder instance whose threads are used and whose
+ * frames are processed by ufo_pipeline_get_next_frame
+ *
+ * \return A new pipeline without any stages or NULL if no memory could be
+ * allocated.
+ */
+UfoPipeline *
+ufo_pipeline_new (UfoDecoder *decoder)
+{
+    UfoPipeline *pipeline = calloc (1, sizeof (UfoPipeline));
 
-                meta->time_stamp = header->timestamp;
-                meta->cmosis_start_address = header->cmosis_start_address;
-                meta->frame_number = header->frame_number;
-                meta->n_rows = header->n_rows;
-                meta->n_skipped_rows = header->n_skipped_rows;
-                break;
-            }
+    if (pipeline == NULL)
+        return NULL;
 
-        case 6:
-            {
-                const header_v6_t *header = (header_v6_t *) &raw[pos + 1];
-                CHECK_VALUE (header->magic_2, 0x52222222);
-                CHECK_VALUE (header->magic_3, 0x53333333);
+    pipeline->decoder = decoder;
+    pipeline->shift = 4;
+    return pipeline;
+}
 
-                dataformat_version = header->dataformat_version;
+static void
+ufo_pipeline_free_scratch (UfoPipeline *pipeline)
+{
+    free (pipeline->scratch);
+    pipeline->scratch = NULL;
+    pipeline->scratch_size = 0;
+}
 
-                meta->output_mode = header->output_mode;
-                meta->adc_resolution = header->adc_resolution;
-                meta->time_stamp = header->timestamp;
-                meta->cmosis_start_address = header->cmosis_start_address;
-                meta->frame_number = header->frame_number;
-                meta->n_rows = header->n_rows;
-                meta->n_skipped_rows = header->n_skipped_rows;
+/**
+ * \brief Release a pipeline
+ *
+ * \param pipeline An UfoPipeline instance
+ */
+void
+ufo_pipeline_free (UfoPipeline *pipeline)
+{
+    if (pipeline == NULL)
+        return;
 
-                break;
-            }
+    ufo_pipeline_free_scratch (pipeline);
+    free (pipeline->lut);
+    free (pipeline->frame);
+    free (pipeline);
+}
 
-        default:
-            fprintf (stderr, "Unsupported header version %i\n", header_version);
-    }
+/*
+ * Whether stage changes the pixel format, after which no other stage can
+ * follow.
+ */
+static bool
+ufo_stage_is_final (UfoStageType stage)
+{
+    return stage != UFO_STAGE_DEINTERLACE;
+}
 
-#ifdef DEBUG
-    if ((meta->output_mode != IPECAMERA_MODE_4_CHAN_IO) && (meta->output_mode != IPECAMERA_MODE_16_CHAN_IO)) {
-        fprintf (stderr, "Output mode 0x%x is not supported\n", meta->output_mode);
-        return EILSEQ;
-    }
+/**
+ * \brief Append a stage to the pipeline
+ *
+ * All stages but UFO_STAGE_DEINTERLACE change the pixel format and must be
+ * the last stage. UFO_STAGE_BAYER_TO_RGB produces 24 bit RGB,
+ * UFO_STAGE_PACK_12 packs two pixels into three bytes with the lower bits
+ * first, UFO_STAGE_TO_8_BIT reduces pixels as set up with
+ * ufo_pipeline_set_shift or ufo_pipeline_set_lut and UFO_STAGE_TO_FLOAT
+ * writes 32 bit floats. Rows are packed separately, so that a row with an odd
+ * number of pixels ends with a half-filled byte.
+ *
+ * \param pipeline An UfoPipeline instance
+ * \param stage Stage to append
+ *
+ * \return 0 in case of no error, EINVAL if the stage cannot follow the last
+ * one or there are too many stages.
+ */
+int
+ufo_pipeline_add_stage (UfoPipeline *pipeline, UfoStageType stage)
+{
+    const size_t n = pipeline->num_stages;
 
-    if (err) {
-        fprintf (stderr, "Corrupt data:");
+    if ((n == IPECAMERA_MAX_STAGES) || ((n > 0) && ufo_stage_is_final (pipeline->stages[n - 1])))
+        return EINVAL;
 
-        for (int i = 0; i < pos; i++) {
-            if ((i % 8) == 0)
-                fprintf (stderr, "\n");
+    if ((stage < UFO_STAGE_DEINTERLACE) || (stage > UFO_STAGE_TO_FLOAT))
+        return EINVAL;
 
-            fprintf (stderr, " %#08x", raw[i]);
-        }
+    pipeline->stages[pipeline->num_stages++] = stage;
+    return 0;
+}
 
-        fprintf (stderr, "\n");
+/**
+ * \brief Set the input value that is mapped to 255 by UFO_STAGE_BAYER_TO_RGB
+ *
+ * \param pipeline An UfoPipeline instance
+ * \param max Largest value, larger ones are clamped. 0 uses the brightest
+ * pixel of each frame, which costs an extra pass over the frame.
+ */
+void
+ufo_pipeline_set_max (UfoPipeline *pipeline, uint16_t max)
+{
+    pipeline->max = max;
+}
+
+/**
+ * \brief Set how far UFO_STAGE_TO_8_BIT shifts pixels to the right
+ *
+ * Larger results are clamped to 255. The default of 4 maps 12 bit pixels to 8
+ * bits.
+ *
+ * \param pipeline An UfoPipeline instance
+ * \param shift Number of bits dropped
+ */
+void
+ufo_pipeline_set_shift (UfoPipeline *pipeline, unsigned shift)
+{
+    pipeline->shift = shift < 16 ? shift : 16;
+}
+
+/**
+ * \brief Set a table that maps 12 bit pixels to 8 bits in UFO_STAGE_TO_8_BIT
+ *
+ * The table is used instead of the shift until it is reset with NULL. Only
+ * the lower twelve bits of each pixel are looked up.
+ *
+ * \param pipeline An UfoPipeline instance
+ * \param lut Table of 4096 entries, which is copied, or NULL
+ *
+ * \return 0 in case of no error, ENOMEM if the table could not be copied.
+ */
+int
+ufo_pipeline_set_lut (UfoPipeline *pipeline, const uint8_t *lut)
+{
+    if (lut == NULL) {
+        free (pipeline->lut);
+        pipeline->lut = NULL;
         return 0;
     }
-#endif
 
-    pos += 8;
+    if (pipeline->lut == NULL) {
+        pipeline->lut = malloc (IPECAMERA_LUT_SIZE);
 
-    switch (dataformat_version) {
-        case 5:
-            advance = ufo_decode_frame_channels_v5 (decoder, pixels, raw + pos, num_bytes - pos, rows_per_frame, meta->output_mode);
-            break;
+        if (pipeline->lut == NULL)
+            return ENOMEM;
+    }
 
-        case 6:
-            advance = ufo_decode_frame_channels_v6 (decoder, pixels, raw + pos, num_bytes - pos, rows_per_frame, meta->cmosis_start_address);
-            break;
+    memcpy (pipeline->lut, lut, IPECAMERA_LUT_SIZE);
+    return 0;
+}
+
+static size_t
+ufo_stage_get_num_rows (UfoStageType stage, size_t num_rows)
+{
+    return stage == UFO_STAGE_DEINTERLACE ? 2 * num_rows : num_rows;
+}
+
+/*
+ * Rows [first, last) of the input of a stage with num_rows rows that are
+ * needed to compute its output rows [out_first, out_last).
+ */
+static void
+ufo_stage_get_input_rows (UfoStageType stage, size_t num_rows, size_t out_first, size_t out_last,
+                          size_t *first, size_t *last)
+{
+    if (stage == UFO_STAGE_DEINTERLACE) {
+        *first = out_first / 2;
+        *last = out_last / 2 + 1;
+    }
+    else if (stage == UFO_STAGE_BAYER_TO_RGB) {
+        *first = out_first > 0 ? out_first - 1 : 0;
+        *last = out_last + 1;
+    }
+    else {
+        *first = out_first;
+        *last = out_last;
+    }
 
+    if (*last > num_rows)
+        *last = num_rows;
+}
+
+/*
+ * Bytes of an output row of stage for rows of width pixels.
+ */
+static size_t
+ufo_stage_get_row_size (UfoStageType stage, size_t width)
+{
+    switch (stage) {
+        case UFO_STAGE_BAYER_TO_RGB:
+            return 3 * width;
+        case UFO_STAGE_PACK_12:
+            return (3 * width + 1) / 2;
+        case UFO_STAGE_TO_8_BIT:
+            return width;
+        case UFO_STAGE_TO_FLOAT:
+            return width * sizeof (float);
         default:
-            fprintf (stderr, "Data format version %i unsupported\n", dataformat_version);
+            return width * sizeof (uint16_t);
     }
+}
 
-    if (err)
-        return 0;
+static size_t
+ufo_pipeline_get_row_size (UfoPipeline *pipeline, size_t width)
+{
+    const size_t n = pipeline->num_stages;
 
-    pos += advance;
+    return n > 0 ? ufo_stage_get_row_size (pipeline->stages[n - 1], width) : width * sizeof (uint16_t);
+}
+
+/**
+ * \brief Get the size of a processed frame
+ *
+ * \param pipeline An UfoPipeline instance
+ * \param width Width of the input frames in pixels
+ * \param height Height of the input frames in pixels
+ *
+ * \return Number of bytes written by the pipeline for a frame of the given
+ * size.
+ */
+size_t
+ufo_pipeline_get_output_size (UfoPipeline *pipeline, int width, int height)
+{
+    size_t num_rows = height;
 
-    CHECK_VALUE(raw[pos], 0x0AAAAAAA);
-    pos++;
+    for (size_t i = 0; i < pipeline->num_stages; i++)
+        num_rows = ufo_stage_get_num_rows (pipeline->stages[i], num_rows);
 
-    meta->status1.bits = raw[pos++];
-    meta->status2.bits = raw[pos++];
-    meta->status3.bits = raw[pos++];
-    pos += 2;
+    return num_rows * ufo_pipeline_get_row_size (pipeline, width);
+}
+
+typedef struct {
+    UfoPipeline        *pipeline;
+    const uint16_t     *in;
+    uint8_t            *out;
+    size_t              width;
+    size_t              num_rows[IPECAMERA_MAX_STAGES + 1];     /**< Input rows of each stage */
+    size_t              tile_rows;
+    size_t              num_bands;
+    uint32_t            max;
+    uint32_t            factor;
+    UfoBayerRowFunc     convert_row;
+    UfoAverageRowsFunc  average;
+} UfoPipelineJob;
+
+/*
+ * Pack pairs of 12 bit pixels into three bytes, the first pixel going into the
+ * first byte and the lower half of the second byte.
+ */
+static void
+ufo_pack_row_12 (const uint16_t *in, uint8_t *out, size_t width)
+{
+    size_t i;
 
-    CHECK_VALUE(raw[pos], 0x00000000);
-    pos++;
+    for (i = 0; i + 1 < width; i += 2, out += 3) {
+        out[0] = (uint8_t) in[i];
+        out[1] = (uint8_t) (((in[i] >> 8) & 0xf) | (in[i + 1] << 4));
+        out[2] = (uint8_t) (in[i + 1] >> 4);
+    }
 
-    CHECK_VALUE(raw[pos], 0x01111111);
-    pos++;
+    if (i < width) {
+        out[0] = (uint8_t) in[i];
+        out[1] = (uint8_t) ((in[i] >> 8) & 0xf);
+    }
+}
 
-    if (err)
-        return 0;
+static void
+ufo_shift_row_8 (const uint16_t *in, uint8_t *out, size_t width, unsigned shift)
+{
+    for (size_t i = 0; i < width; i++) {
+        const uint16_t value = in[i] >> shift;
 
-    return pos;
+        out[i] = value > 255 ? 255 : (uint8_t) value;
+    }
+}
+
+static void
+ufo_lookup_row_8 (const uint16_t *in, uint8_t *out, size_t width, const uint8_t *lut)
+{
+    for (size_t i = 0; i < width; i++)
+        out[i] = lut[in[i] & (IPECAMERA_LUT_SIZE - 1)];
+}
+
+static void
+ufo_float_row (const uint16_t *in, float *out, size_t width)
+{
+    for (size_t i = 0; i < width; i++)
+        out[i] = in[i];
+}
+
+/*
+ * Compute rows [first, last) of the output of a stage. in holds the input
+ * rows starting at in_first, out receives the output rows starting at first.
+ */
+static void
+ufo_run_stage (const UfoPipelineJob *job, size_t index, const uint16_t *in, size_t in_first,
+               uint8_t *out, size_t first, size_t last)
+{
+    const size_t width = job->width;
+    const size_t num_rows = job->num_rows[index];
+    const UfoStageType stage = job->pipeline->stages[index];
+    const size_t row_bytes = ufo_stage_get_row_size (stage, width);
+
+    for (size_t row = first; row < last; row++) {
+        uint8_t *dst = out + (row - first) * row_bytes;
+
+        switch (stage) {
+            case UFO_STAGE_DEINTERLACE: {
+                const uint16_t *src = in + (row / 2 - in_first) * width;
+
+                if ((row % 2 == 0) || (row / 2 + 1 >= num_rows))
+                    memcpy (dst, src, row_bytes);
+                else
+                    job->average (src, src + width, (uint16_t *) dst, width);
+
+                break;
+            }
+            case UFO_STAGE_BAYER_TO_RGB:
+                /* The border rows are left alone like the columns */
+                if ((row > 0) && (row + 1 < num_rows))
+                    job->convert_row (in + (row - in_first) * width, dst, width, row, job->max, job->factor);
+
+                break;
+            case UFO_STAGE_PACK_12:
+                ufo_pack_row_12 (in + (row - in_first) * width, dst, width);
+                break;
+            case UFO_STAGE_TO_8_BIT:
+                if (job->pipeline->lut != NULL)
+                    ufo_lookup_row_8 (in + (row - in_first) * width, dst, width, job->pipeline->lut);
+                else
+                    ufo_shift_row_8 (in + (row - in_first) * width, dst, width, job->pipeline->shift);
+
+                break;
+            case UFO_STAGE_TO_FLOAT:
+                ufo_float_row (in + (row - in_first) * width, (float *) dst, width);
+                break;
+        }
+    }
+}
+
+static void
+ufo_pipeline_band (void *data, size_t index)
+{
+    UfoPipelineJob *job = (UfoPipelineJob *) data;
+    UfoPipeline *pipeline = job->pipeline;
+    const size_t num_stages = pipeline->num_stages;
+    const size_t num_out = job->num_rows[num_stages];
+    const size_t band_first = num_out * index / job->num_bands;
+    const size_t band_last = num_out * (index + 1) / job->num_bands;
+    const size_t row_size = ufo_pipeline_get_row_size (pipeline, job->width);
+    uint16_t *scratch = NULL;
+
+    if (num_stages > 1)
+        scratch = pipeline->scratch + index * (num_stages - 1) * pipeline->scratch_rows * job->width;
+
+    for (size_t tile = band_first; tile < band_last; tile += job->tile_rows) {
+        size_t first[IPECAMERA_MAX_STAGES + 1];
+        size_t last[IPECAMERA_MAX_STAGES + 1];
+        const uint16_t *in;
+
+        first[num_stages] = tile;
+        last[num_stages] = tile + job->tile_rows < band_last ? tile + job->tile_rows : band_last;
+
+        for (size_t i = num_stages; i > 0; i--)
+            ufo_stage_get_input_rows (pipeline->stages[i - 1], job->num_rows[i - 1], first[i], last[i],
+                                      &first[i - 1], &last[i - 1]);
+
+        /* Every stage writes the rows the next one needs into its own buffer */
+        in = job->in + first[0] * job->width;
+
+        for (size_t i = 0; i < num_stages; i++) {
+            uint8_t *out;
+
+            if (i + 1 == num_stages)
+                out = job->out + first[num_stages] * row_size;
+            else
+                out = (uint8_t *) (scratch + i * pipeline->scratch_rows * job->width);
+
+            ufo_run_stage (job, i, in, first[i], out, first[i + 1], last[i + 1]);
+            in = (const uint16_t *) out;
+        }
+    }
 }
 
 /**
- * \brief Iterate and decode next frame
+ * \brief Run the stages of a pipeline on a frame
  *
- * This function tries to decode the next frame in the currently set raw data
- * stream.
+ * Without any stages the frame is copied.
  *
- * \param decoder An UfoDecoder instance
- * \param pixels If pointer with NULL content is passed, a new buffer is
- * allocated otherwise, this user-supplied buffer is used.
- * \param num_rows Number of actual decoded rows
- * \param frame_number Frame number as reported in the header
- * \param time_stamp Time stamp of the frame as reported in the header
+ * \param pipeline An UfoPipeline instance
+ * \param frame Input frame with 16 bit pixels
+ * \param width Width of the frame in pixels
+ * \param height Height of the frame in pixels
+ * \param out Location for the result, which must be at least as large as
+ * reported by ufo_pipeline_get_output_size.
  *
- * \return 0 in case of no error, EIO if end of stream was reached, ENOMEM if
- * NULL was passed but no memory could be allocated, EILSEQ if data stream is
- * corrupt and EFAULT if pixels is a NULL-pointer.
+ * \return 0 in case of no error, EINVAL if the frame is too small for the
+ * stages and ENOMEM if the tile buffers could not be allocated.
  */
 int
-ufo_decoder_get_next_frame (UfoDecoder *decoder, uint16_t **pixels, UfoDecoderMeta *meta)
+ufo_pipeline_process (UfoPipeline *pipeline, const uint16_t *frame, int width, int height, void *out)
 {
-    uint32_t *raw = decoder->raw;
-    size_t pos = decoder->current_pos;
-    size_t advance;
-    const size_t num_words = decoder->num_bytes / 4;
+    UfoThreadPool *pool = pipeline->decoder->pool;
+    const size_t num_stages = pipeline->num_stages;
+    UfoPipelineJob job;
+    size_t scratch_size;
 
-    if (pixels == NULL)
-        return 0;
+    if (width <= 0 || height <= 0)
+        return EINVAL;
 
-    if ((pos >= num_words) || ((num_words - pos) < 4096))
-        return EIO;
+    if (num_stages == 0) {
+        memcpy (out, frame, (size_t) width * height * sizeof (uint16_t));
+        return 0;
+    }
 
-    if (num_words < 16)
-        return EILSEQ;
+    job.pipeline = pipeline;
+    job.in = frame;
+    job.out = (uint8_t *) out;
+    job.width = width;
+    job.num_rows[0] = height;
+    job.num_bands = pool != NULL ? ufo_thread_pool_get_num_threads (pool) : 1;
+    job.tile_rows = IPECAMERA_TILE_BYTES / (width * sizeof (uint16_t));
+    job.convert_row = ufo_select_bayer_kernel ();
+    job.average = ufo_average_rows;
+
+#ifdef HAVE_AVX2
+    if (ufo_use_avx2 ())
+        job.average = ufo_average_rows_avx2;
+#endif
 
-    if (*pixels == NULL) {
-        *pixels = (uint16_t *) malloc (IPECAMERA_WIDTH * decoder->height * sizeof(uint16_t));
+    if (job.tile_rows == 0)
+        job.tile_rows = 1;
 
-        if (*pixels == NULL)
-            return ENOMEM;
-    }
+    for (size_t i = 0; i < num_stages; i++)
+        job.num_rows[i + 1] = ufo_stage_get_num_rows (pipeline->stages[i], job.num_rows[i]);
 
-    while ((pos < num_words) &&
-           ((raw[pos] & 0xFFFFFFF0) != 0x51111110)) /* we can only match the first part */
-        pos++;
+    if (pipeline->stages[num_stages - 1] == UFO_STAGE_BAYER_TO_RGB) {
+        if (width < 3)
+            return EINVAL;
 
-    /* before even attempting to decode the non-existent frame, bail out */
-    if (pos == num_words) {
-        return EIO;
+        /* Interpolated rows never exceed the input, so the maximum is found there */
+        job.max = pipeline->max != 0 ? pipeline->max : ufo_find_max (pool, frame, (size_t) width * height);
+        job.factor = ufo_bayer_factor (job.max);
     }
 
-    advance = ufo_decoder_decode_frame (decoder, raw + pos, decoder->num_bytes - pos, *pixels, meta);
-
-    /*
-     * On error, advance is 0 but we have to advance at least a bit to net get
-     * caught in an infinite loop when trying to decode subsequent frames.
-     */
-    pos += advance == 0 ? 1 : advance;
+    /* Tiles grow by at most two rows per stage on the way back to the input */
+    pipeline->scratch_rows = job.tile_rows + 2 * num_stages;
+    scratch_size = job.num_bands * (num_stages - 1) * pipeline->scratch_rows * width * sizeof (uint16_t);
 
-    /* if bytes left and we see fill bytes, skip them */
-    if (((pos + 2) < num_words) && ((raw[pos] == 0x0) && ((raw[pos+1] == 0x1111111) || raw[pos+1] == 0x0))) {
-        pos += 2;
-        while ((pos < num_words) &&
-               ((raw[pos] == 0x89abcdef) || (raw[pos] == 0x1234567) ||
-                (raw[pos] == 0x0) || (raw[pos] == 0xdeadbeef) || (0x98badcfe)))     /* new filling ... */ {
-            pos++;
-        }
-    }
+    if (scratch_size > pipeline->scratch_size) {
+        ufo_pipeline_free_scratch (pipeline);
+        pipeline->scratch = malloc (scratch_size);
 
-    decoder->current_pos = pos;
+        if (pipeline->scratch == NULL)
+            return ENOMEM;
 
-    if (!advance)
-        return EILSEQ;
+        pipeline->scratch_size = scratch_size;
+    }
 
+    ufo_run_bands (pool, ufo_pipeline_band, &job, job.num_bands);
     return 0;
 }
 
 /**
- * \brief Convert Bayer pattern to RGB
+ * \brief Decode the next frame and run the stages of a pipeline on it
  *
- * Convert Bayer pattern to RGB via bilinear interpolation.
+ * The frame is decoded like with ufo_decoder_get_next_frame into a buffer
+ * owned by the pipeline.
  *
- * \param in 16 bit input data in Bayer pattern format
- * \param out Location for 24 bit output data in RGB format. At
- * least width x height x 3 bytes must be allocated.
- * \param width Width of a frame
- * \param height Height of a frame
+ * \param pipeline An UfoPipeline instance
+ * \param out Location for the result. The frame has the size of the region of
+ * interest if one is set. Otherwise it has as many rows as the header of the
+ * frame reports, but never more than the height passed to ufo_decoder_new or
+ * 4096 if that was not positive. out must be as large as reported by
+ * ufo_pipeline_get_output_size for that many rows.
+ * \param meta Meta data of the decoded frame
+ *
+ * \return 0 in case of no error, EIO if end of stream was reached, ENOMEM if
+ * no memory could be allocated and EILSEQ if data stream is corrupt.
  */
-void
-ufo_convert_bayer_to_rgb (const uint16_t *in, uint8_t *out, int width, int height)
+int
+ufo_pipeline_get_next_frame (UfoPipeline *pipeline, void *out, UfoDecoderMeta *meta)
 {
-    /* According to the CMV docs, the pattern starts at (0,0) with
-     *
-     *   R G
-     *   G B
-     */
+    UfoDecoder *decoder = pipeline->decoder;
+    size_t num_rows = ufo_decoder_get_num_rows (decoder);
+    int err;
+
+    /* The region of interest may have changed since the last frame */
+    if (pipeline->frame_pixels != ufo_decoder_get_num_pixels (decoder)) {
+        free (pipeline->frame);
+        pipeline->frame_pixels = ufo_decoder_get_num_pixels (decoder);
+        pipeline->frame = ufo_decoder_alloc_frame (decoder);
+
+        if (pipeline->frame == NULL) {
+            pipeline->frame_pixels = 0;
+            return ENOMEM;
+        }
+    }
 
-#define BY(x,y) in[(x) + width * (y)]
-#define R(x,y) out[0 + 3 * ((x) + width * (y))]
-#define G(x,y) out[1 + 3 * ((x) + width * (y))]
-#define B(x,y) out[2 + 3 * ((x) + width * (y))]
+    err = ufo_decoder_get_next_frame (decoder, &pipeline->frame, meta);
 
-    double scale;
-    uint16_t max = 0;
+    if (err)
+        return err;
+
+    if (decoder->roi_width > 0)
+        return ufo_pipeline_process (pipeline, pipeline->frame, decoder->roi_width, decoder->roi_height, out);
+
+    /* The header must not make the stages read past the frame */
+    if ((meta->n_rows > 0) && (meta->n_rows < num_rows))
+        num_rows = meta->n_rows;
 
-    for (int i = 0; i < width * height; i++) {
-        if (max < in[i])
-            max = in[i];
-    }
-
-    scale = 255. / max;
-
-    for (int i = 1; i < width - 1; i += 2) {
-        for (int j = 1; j < height - 1; j += 2) {
-            /* Top left */
-            R(i + 0, j + 0) = ((uint32_t) BY(i - 1, j - 1) +
-                               (uint32_t) BY(i + 1, j - 1) +
-                               (uint32_t) BY(i - 1, j + 1) +
-                               (uint32_t) BY(i + 1, j + 1)) / 4 * scale;
-            G(i + 0, j + 0) = ((uint32_t) BY(i - 1, j + 0) +
-                               (uint32_t) BY(i + 0, j - 1) +
-                               (uint32_t) BY(i + 1, j + 0) +
-                               (uint32_t) BY(i + 0, j + 1)) / 4 * scale;
-            B(i + 0, j + 0) = BY(i + 0, j + 0) * scale;
-
-            /* Top right */
-            R(i + 1, j + 0) = ((uint32_t) BY(i + 1, j - 1) +
-                               (uint32_t) BY(i + 1, j + 1)) / 2 * scale;
-            G(i + 1, j + 0) = BY(i + 1, j + 0) * scale;
-            B(i + 1, j + 0) = ((uint32_t) BY(i + 0, j + 0) +
-                               (uint32_t) BY(i + 2, j + 0)) / 2 * scale;
-
-            /* Lower left */
-            R(i + 0, j + 1) = ((uint32_t) BY(i - 1, j + 0) +
-                               (uint32_t) BY(i + 1, j + 1)) / 2 * scale;
-            G(i + 0, j + 1) = BY(i + 0, j + 1) * scale;
-            B(i + 0, j + 1) = ((uint32_t) BY(i + 0, j + 0) +
-                               (uint32_t) BY(i + 0, j + 2)) / 2 * scale;
-
-            /* Lower right */
-            R(i + 1, j + 1) = BY(i + 1, j + 1) * scale;
-            G(i + 1, j + 1) = ((uint32_t) BY(i + 1, j + 0) +
-                               (uint32_t) BY(i + 0, j + 1) +
-                               (uint32_t) BY(i + 2, j + 1) +
-                               (uint32_t) BY(i + 2, j + 1)) / 4 * scale;
-            B(i + 1, j + 1) = ((uint32_t) BY(i + 0, j + 0) +
-                               (uint32_t) BY(i + 2, j + 0) +
-                               (uint32_t) BY(i + 0, j + 2) +
-                               (uint32_t) BY(i + 2, j + 2)) / 4 * scale;
-        }
-    }
-
-#undef R
-#undef G
-#undef B
+    return ufo_pipeline_process (pipeline, pipeline->frame, decoder->width, (int) num_rows, out);
 }
@@ -4,6 +4,15 @@
 #include <inttypes.h>
 
 typedef struct _UfoDecoder UfoDecoder;
+typedef struct _UfoPipeline UfoPipeline;
+
+typedef enum {
+    UFO_STAGE_DEINTERLACE,      /**< Interpolate a row between each two rows */
+    UFO_STAGE_BAYER_TO_RGB,     /**< Convert Bayer pattern to 24 bit RGB */
+    UFO_STAGE_PACK_12,          /**< Pack two 12 bit pixels into three bytes */
+    UFO_STAGE_TO_8_BIT,         /**< Shift or look up 8 bit pixels */
+    UFO_STAGE_TO_FLOAT,         /**< Convert to 32 bit floating point pixels */
+} UfoStageType;
 
 typedef struct {
     unsigned    data_lock:16;
@@ -62,6 +71,38 @@ typedef struct {
     }                       status3;
 } UfoDecoderMeta;
 
+typedef struct {
+    uint64_t        num_frames;         /**< Frames decoded without error */
+    uint64_t        num_corrupt_frames; /**< Frames that could not be decoded */
+    uint64_t        num_bytes;          /**< Bytes of the data stream consumed */
+    uint64_t        num_resync_words;   /**< Words skipped looking for a frame */
+    uint64_t        num_fill_words;     /**< Fill words skipped after frames */
+    uint64_t        header_ns;          /**< Time parsing headers and footers */
+    uint64_t        payload_ns;         /**< Time decoding payloads */
+    uint64_t        scan_ns;            /**< Time searching for frames */
+} UfoDecoderStats;
+
+typedef struct {
+    uint32_t       *raw;
+    size_t          num_bytes;
+} UfoSegment;
+
+typedef struct {
+    size_t          segment;        /**< Index of the current segment */
+    size_t          offset;         /**< Word offset in the current segment */
+} UfoCursor;
+
+typedef struct {
+    uint64_t        offset;         /**< Word offset of the frame in the raw data */
+    uint32_t        frame_number;
+    uint32_t        time_stamp;
+} UfoFrameIndexEntry;
+
+typedef struct {
+    size_t              num_frames;
+    UfoFrameIndexEntry *frames;
+} UfoFrameIndex;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -71,6 +112,26 @@ UfoDecoder *ufo_decoder_new             (int32_t         height,
                                          uint32_t       *raw, 
                                          size_t          num_bytes);
 void        ufo_decoder_free            (UfoDecoder     *decoder);
+int         ufo_decoder_set_num_threads (UfoDecoder     *decoder,
+                                         uint32_t        num_threads);
+void        ufo_decoder_set_timing      (UfoDecoder     *decoder,
+                                         int             enable);
+void        ufo_decoder_get_stats       (UfoDecoder     *decoder,
+                                         UfoDecoderStats *stats);
+void        ufo_decoder_reset_stats     (UfoDecoder     *decoder);
+int         ufo_decoder_set_roi         (UfoDecoder     *decoder,
+                                         uint32_t        x,
+                                         uint32_t        y,
+                                         uint32_t        width,
+                                         uint32_t        height);
+int         ufo_decoder_set_frames_ahead
+                                        (UfoDecoder     *decoder,
+                                         uint32_t        num_frames);
+int         ufo_decoder_set_num_buffers (UfoDecoder     *decoder,
+                                         uint32_t        num_buffers);
+uint16_t   *ufo_decoder_acquire_frame   (UfoDecoder     *decoder);
+int         ufo_decoder_release_frame   (UfoDecoder     *decoder,
+                                         uint16_t       *pixels);
 size_t      ufo_decoder_decode_frame    (UfoDecoder     *decoder, 
                                          uint32_t       *raw, 
                                          size_t          num_bytes, 
@@ -79,9 +140,51 @@ size_t      ufo_decoder_decode_frame    (UfoDecoder     *decoder,
 void        ufo_decoder_set_raw_data    (UfoDecoder     *decoder,
                                          uint32_t       *raw,
                                          size_t          num_bytes);
+size_t      ufo_decoder_get_position    (UfoDecoder     *decoder);
+size_t      ufo_decoder_get_num_rows    (const UfoDecoder *decoder);
 int         ufo_decoder_get_next_frame  (UfoDecoder     *decoder, 
                                          uint16_t      **pixels, 
                                          UfoDecoderMeta *meta_data);
+int         ufo_decoder_get_next_frame_buffer
+                                        (UfoDecoder     *decoder,
+                                         uint16_t      **pixels,
+                                         UfoDecoderMeta *meta_data);
+int         ufo_decoder_get_next_meta   (UfoDecoder     *decoder,
+                                         UfoDecoderMeta *meta_data);
+int         ufo_decoder_get_next_frames (UfoDecoder     *decoder,
+                                         uint16_t      **pixels,
+                                         UfoDecoderMeta *meta_data,
+                                         size_t          num_frames,
+                                         size_t         *num_decoded);
+size_t      ufo_decoder_decode_frame_segments
+                                        (UfoDecoder     *decoder,
+                                         const UfoSegment *segments,
+                                         size_t          num_segments,
+                                         uint16_t       *pixels,
+                                         UfoDecoderMeta *meta);
+int         ufo_decoder_get_next_frame_segments
+                                        (UfoDecoder     *decoder,
+                                         const UfoSegment *segments,
+                                         size_t          num_segments,
+                                         UfoCursor      *cursor,
+                                         uint16_t      **pixels,
+                                         UfoDecoderMeta *meta_data);
+int         ufo_decoder_push_data       (UfoDecoder     *decoder,
+                                         const uint32_t *raw,
+                                         size_t          num_bytes);
+int         ufo_decoder_pop_frame       (UfoDecoder     *decoder,
+                                         uint16_t      **pixels,
+                                         UfoDecoderMeta *meta_data);
+UfoFrameIndex *
+            ufo_decoder_build_index     (UfoDecoder     *decoder);
+int         ufo_decoder_seek            (UfoDecoder     *decoder,
+                                         const UfoFrameIndex *index,
+                                         size_t          frame);
+void        ufo_frame_index_free        (UfoFrameIndex  *index);
+int         ufo_frame_index_save        (const UfoFrameIndex *index,
+                                         const char     *filename);
+UfoFrameIndex *
+            ufo_frame_index_load        (const char     *filename);
 void        ufo_deinterlace_interpolate (const uint16_t *frame_in, 
                                          uint16_t       *frame_out, 
                                          int             width, 
@@ -91,10 +194,53 @@ void        ufo_deinterlace_weave       (const uint16_t *in1,
                                          uint16_t       *out, 
                                          int             width, 
                                          int             height);
+void        ufo_decoder_deinterlace_interpolate
+                                        (UfoDecoder     *decoder,
+                                         const uint16_t *frame_in,
+                                         uint16_t       *frame_out,
+                                         int             width,
+                                         int             height);
+void        ufo_decoder_deinterlace_weave
+                                        (UfoDecoder     *decoder,
+                                         const uint16_t *in1,
+                                         const uint16_t *in2,
+                                         uint16_t       *out,
+                                         int             width,
+                                         int             height);
 void        ufo_convert_bayer_to_rgb    (const uint16_t *in,
                                          uint8_t        *out,
                                          int             width,
                                          int             height);
+void        ufo_decoder_convert_bayer_to_rgb
+                                        (UfoDecoder     *decoder,
+                                         const uint16_t *in,
+                                         uint8_t        *out,
+                                         int             width,
+                                         int             height,
+                                         uint16_t        max);
+UfoPipeline *
+            ufo_pipeline_new            (UfoDecoder     *decoder);
+void        ufo_pipeline_free           (UfoPipeline    *pipeline);
+int         ufo_pipeline_add_stage      (UfoPipeline    *pipeline,
+                                         UfoStageType    stage);
+void        ufo_pipeline_set_max        (UfoPipeline    *pipeline,
+                                         uint16_t        max);
+void        ufo_pipeline_set_shift      (UfoPipeline    *pipeline,
+                                         unsigned        shift);
+int         ufo_pipeline_set_lut        (UfoPipeline    *pipeline,
+                                         const uint8_t  *lut);
+size_t      ufo_pipeline_get_output_size
+                                        (UfoPipeline    *pipeline,
+                                         int             width,
+                                         int             height);
+int         ufo_pipeline_process        (UfoPipeline    *pipeline,
+                                         const uint16_t *frame,
+                                         int             width,
+                                         int             height,
+                                         void           *out);
+int         ufo_pipeline_get_next_frame (UfoPipeline    *pipeline,
+                                         void           *out,
+                                         UfoDecoderMeta *meta);
 
 #ifdef __cplusplus
 }
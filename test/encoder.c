@@ -0,0 +1,421 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "config.h"
+#include "encoder.h"
+
+#define NUM_CHANNELS        16
+#define PIXELS_PER_CHANNEL  128
+#define MAX_ROWS            4096    /* Rows addressable by a payload block */
+#define MAX_V6_COLUMNS      4096    /* Columns addressable by a v6 payload block */
+
+/* Words following the last frame, the decoder stops if less are left */
+#define PADDING_WORDS       4096
+
+/*
+ * A v6 payload block holds eight channels twice. Decoders built with SSE put
+ * the second half into the next row, the others into the next eight channels,
+ * so the layout of the stream has to match the build.
+ */
+#ifdef HAVE_SSE
+# define V6_ROWS_PER_BLOCK      2
+# define V6_COLUMNS_PER_GROUP   (8 * PIXELS_PER_CHANNEL)
+#else
+# define V6_ROWS_PER_BLOCK      1
+# define V6_COLUMNS_PER_GROUP   (NUM_CHANNELS * PIXELS_PER_CHANNEL)
+#endif
+
+enum {
+    CORRUPT_HEADER,
+    CORRUPT_FOOTER,
+    CORRUPT_TRUNCATE,
+    NUM_CORRUPTIONS
+};
+
+static const uint32_t fill_words[] = { 0x89abcdef, 0x01234567, 0xdeadbeef, 0x98badcfe };
+
+static uint32_t
+next_random (uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static int
+get_pixel_bits (const EncoderParams *params)
+{
+    if (params->version == 5)
+        return params->four_channels ? 12 : 10;
+
+    return params->adc_bits;
+}
+
+/*
+ * Columns of a row that the payload blocks can address. The rest of a frame
+ * is left as it is by the decoder.
+ */
+static uint32_t
+get_num_columns (const EncoderParams *params)
+{
+    if (params->version == 5)
+        return NUM_CHANNELS * PIXELS_PER_CHANNEL;
+
+    const uint32_t columns = params->width < MAX_V6_COLUMNS ? params->width : MAX_V6_COLUMNS;
+    return columns - columns % V6_COLUMNS_PER_GROUP;
+}
+
+static size_t
+get_num_fill_words (const EncoderParams *params)
+{
+    /* Fill words are only recognized after a two word marker */
+    if (params->num_fill_words > 0 && params->num_fill_words < 2)
+        return 2;
+
+    return params->num_fill_words;
+}
+
+static size_t
+get_payload_words (const EncoderParams *params)
+{
+    if (params->version == 5) {
+        /* Four channels of 128 blocks ended with 0xe0 blocks, the row with 0xc0 */
+        const size_t num_blocks = params->four_channels ? 4 * (PIXELS_PER_CHANNEL + 1) + 1 : PIXELS_PER_CHANNEL;
+        return params->height * num_blocks * 8;
+    }
+
+    return (params->height / V6_ROWS_PER_BLOCK) * (get_num_columns (params) / V6_COLUMNS_PER_GROUP) * PIXELS_PER_CHANNEL * 8;
+}
+
+/**
+ * Set default parameters, which describe a 2048 x 1088 frame in data format
+ * version 6 with 12 bit pixels.
+ */
+void
+encoder_params_init (EncoderParams *params)
+{
+    memset (params, 0, sizeof (EncoderParams));
+    params->version = 6;
+    params->width = 2048;
+    params->height = 1088;
+    params->adc_bits = 12;
+    params->seed = 1;
+}
+
+/**
+ * Return 0 if frames with these parameters can be encoded, EINVAL otherwise.
+ */
+int
+encoder_check (const EncoderParams *params)
+{
+    if (params->width % PIXELS_PER_CHANNEL || params->width < NUM_CHANNELS * PIXELS_PER_CHANNEL)
+        return EINVAL;
+
+    if (params->height == 0)
+        return EINVAL;
+
+    if (params->version == 5)
+        return params->height <= MAX_ROWS ? 0 : EINVAL;
+
+    if (params->version != 6 || params->four_channels)
+        return EINVAL;
+
+    if (params->adc_bits != 11 && params->adc_bits != 12)
+        return EINVAL;
+
+    if (params->height % V6_ROWS_PER_BLOCK || params->start_address + params->height > MAX_ROWS)
+        return EINVAL;
+
+    return 0;
+}
+
+/**
+ * Upper bound of the size of an encoded frame in words, including the fill
+ * words after it.
+ */
+size_t
+encoder_get_frame_words (const EncoderParams *params)
+{
+    return 8 + get_payload_words (params) + 8 + get_num_fill_words (params);
+}
+
+/**
+ * Fill a frame of width x height pixels with random values of the pixel size
+ * of the data format. Pixels that are not part of the stream are set to 0,
+ * which is what a cleared frame contains after decoding.
+ */
+void
+encoder_fill_frame (const EncoderParams *params, uint16_t *pixels)
+{
+    const uint32_t num_columns = get_num_columns (params);
+    const uint16_t mask = (1 << get_pixel_bits (params)) - 1;
+    uint32_t state = params->seed != 0 ? params->seed : 1;
+
+    for (size_t y = 0; y < params->height; y++) {
+        uint16_t *row = pixels + y * params->width;
+
+        for (size_t x = 0; x < params->width; x++)
+            row[x] = x < num_columns ? next_random (&state) & mask : 0;
+    }
+}
+
+static uint32_t *
+encode_header (const EncoderParams *params, uint32_t frame_number, uint32_t *raw)
+{
+    const uint32_t output_mode = params->four_channels ? 2 : 0;
+    const uint32_t adc_resolution = params->adc_bits == 11 ? 1 : 2;
+
+    raw[0] = 0x51111112;
+    raw[1] = 0x52222222;
+    raw[2] = 0x53333333;
+    raw[3] = 0x54444444;
+    raw[4] = params->start_address | (output_mode << 16) | (adc_resolution << 20) | (5u << 28);
+    raw[5] = params->height | (5u << 28);
+    raw[6] = (frame_number & 0xffffff) | ((uint32_t) params->version << 24) | (5u << 28);
+    raw[7] = ((frame_number * 100) & 0xfffffff) | (5u << 28);
+
+    return raw + 8;
+}
+
+static uint32_t *
+encode_payload_v5 (const EncoderParams *params, const uint16_t *pixels, uint32_t *raw)
+{
+    for (uint32_t y = 0; y < params->height; y++) {
+        const uint16_t *row = pixels + y * params->width;
+
+        for (uint32_t p = 0; p < PIXELS_PER_CHANNEL; p++, raw += 8) {
+            const uint16_t *c = row + p;
+            const uint32_t s = PIXELS_PER_CHANNEL;
+
+            raw[0] = p | (y << 8);
+            raw[1] = 0;
+            raw[2] = (c[15 * s] << 20) | (c[13 * s] << 8) | (c[14 * s] >> 4);
+            raw[3] = ((uint32_t) c[14 * s] << 28) | (c[12 * s] << 16) | (c[10 * s] << 4) | (c[8 * s] >> 8);
+            raw[4] = ((uint32_t) c[8 * s] << 24) | (c[11 * s] << 12) | c[7 * s];
+            raw[5] = (c[9 * s] << 20) | (c[6 * s] << 8) | (c[5 * s] >> 4);
+            raw[6] = ((uint32_t) c[5 * s] << 28) | (c[2 * s] << 16) | (c[4 * s] << 4) | (c[3 * s] >> 8);
+            raw[7] = ((uint32_t) c[3 * s] << 24) | (c[0 * s] << 12) | c[1 * s];
+        }
+    }
+
+    return raw;
+}
+
+static uint32_t *
+encode_marker_v5 (uint32_t magic, uint32_t y, uint32_t *raw)
+{
+    memset (raw, 0, 8 * sizeof (uint32_t));
+    raw[0] = (magic << 24) | (y << 8);
+    return raw + 8;
+}
+
+static uint32_t *
+encode_payload_v5_4ch (const EncoderParams *params, const uint16_t *pixels, uint32_t *raw)
+{
+    const uint32_t s = PIXELS_PER_CHANNEL;
+
+    for (uint32_t y = 0; y < params->height; y++) {
+        const uint16_t *row = pixels + y * params->width;
+
+        for (uint32_t off = 0; off < 4; off++) {
+            for (uint32_t p = 0; p < PIXELS_PER_CHANNEL; p++, raw += 8) {
+                const uint16_t *c = row + off * s + p;
+
+                memset (raw, 0, 8 * sizeof (uint32_t));
+                raw[0] = p | (y << 8);
+                raw[3] = (c[12 * s] << 16) | (c[8 * s] >> 8);
+                raw[4] = (uint32_t) c[8 * s] << 24;
+                raw[6] = c[4 * s] << 4;
+                raw[7] = c[0 * s] << 12;
+            }
+
+            raw = encode_marker_v5 (0xe0, y, raw);
+        }
+
+        raw = encode_marker_v5 (0xc0, y, raw);
+    }
+
+    return raw;
+}
+
+/*
+ * Pack eight pixels of bits bits MSB first into three words.
+ */
+static void
+pack_pixels_v6 (const uint16_t *c, int bits, uint32_t *raw)
+{
+    const uint32_t s = PIXELS_PER_CHANNEL;
+
+    if (bits == 12) {
+        raw[0] = ((uint32_t) c[0 * s] << 20) | (c[1 * s] << 8) | (c[2 * s] >> 4);
+        raw[1] = ((uint32_t) c[2 * s] << 28) | (c[3 * s] << 16) | (c[4 * s] << 4) | (c[5 * s] >> 8);
+        raw[2] = ((uint32_t) c[5 * s] << 24) | (c[6 * s] << 12) | c[7 * s];
+    }
+    else {
+        uint64_t hi = 0;
+        uint32_t lo = 0;
+
+        for (int i = 0; i < 8; i++) {
+            const uint32_t v = c[i * s];
+            const int shift = 85 - 11 * i;
+
+            if (shift >= 32)
+                hi |= (uint64_t) v << (shift - 32);
+            else {
+                if (shift + 11 > 32)
+                    hi |= v >> (32 - shift);
+
+                lo |= v << shift;
+            }
+        }
+
+        raw[0] = hi >> 32;
+        raw[1] = (uint32_t) hi;
+        raw[2] = lo;
+    }
+}
+
+static uint32_t *
+encode_payload_v6 (const EncoderParams *params, const uint16_t *pixels, uint32_t *raw)
+{
+    const uint32_t num_columns = get_num_columns (params);
+
+    for (uint32_t y = 0; y < params->height; y += V6_ROWS_PER_BLOCK) {
+        const uint16_t *row = pixels + y * params->width;
+
+        for (uint32_t x = 0; x < num_columns; x += V6_COLUMNS_PER_GROUP) {
+            for (uint32_t p = 0; p < PIXELS_PER_CHANNEL; p++, raw += 8) {
+                const uint16_t *c = row + x + p;
+
+                raw[0] = params->start_address + y;
+                raw[1] = (x + p) << 16;
+                pack_pixels_v6 (c, params->adc_bits, raw + 2);
+#ifdef HAVE_SSE
+                pack_pixels_v6 (c + params->width, params->adc_bits, raw + 5);
+#else
+                pack_pixels_v6 (c + 8 * PIXELS_PER_CHANNEL, params->adc_bits, raw + 5);
+#endif
+            }
+        }
+    }
+
+    return raw;
+}
+
+static uint32_t *
+encode_footer (uint32_t *raw)
+{
+    raw[0] = 0x0AAAAAAA;
+    raw[1] = 0;
+    raw[2] = 0;
+    raw[3] = 0;
+    raw[4] = 0;
+    raw[5] = 0;
+    raw[6] = 0;
+    raw[7] = 0x01111111;
+
+    return raw + 8;
+}
+
+/**
+ * Encode a frame of width x height pixels into raw, which must hold at least
+ * encoder_get_frame_words words. Pixels must fit into the pixel size of the
+ * data format. Returns the number of words written.
+ */
+size_t
+encoder_encode_frame (const EncoderParams *params, const uint16_t *pixels, uint32_t frame_number, uint32_t *raw)
+{
+    const size_t num_fill_words = get_num_fill_words (params);
+    uint32_t *start = raw;
+
+    raw = encode_header (params, frame_number, raw);
+
+    if (params->version == 5)
+        raw = params->four_channels ? encode_payload_v5_4ch (params, pixels, raw) : encode_payload_v5 (params, pixels, raw);
+    else
+        raw = encode_payload_v6 (params, pixels, raw);
+
+    raw = encode_footer (raw);
+
+    if (num_fill_words > 0) {
+        raw[0] = 0;
+        raw[1] = 0x1111111;
+
+        for (size_t i = 2; i < num_fill_words; i++)
+            raw[i] = fill_words[i % 4];
+
+        raw += num_fill_words;
+    }
+
+    return raw - start;
+}
+
+/**
+ * Whether frame is damaged by encoder_generate.
+ */
+int
+encoder_is_corrupt (const EncoderParams *params, size_t frame)
+{
+    return params->corrupt_every > 0 && (frame + 1) % params->corrupt_every == 0;
+}
+
+/**
+ * Encode num_frames frames with the content of pixels into a new stream,
+ * which is freed with free. Frames are numbered from 0. Corrupt frames have a
+ * broken header or footer or lose the second half of their payload and the
+ * footer.
+ *
+ * \return The stream or NULL if the parameters are invalid or memory could not
+ * be allocated. Its size in bytes is stored in num_bytes.
+ */
+uint32_t *
+encoder_generate (const EncoderParams *params, const uint16_t *pixels, size_t num_frames, size_t *num_bytes)
+{
+    const size_t frame_words = encoder_get_frame_words (params);
+    uint32_t state = params->seed != 0 ? params->seed : 1;
+    uint32_t *stream;
+    uint32_t *raw;
+
+    if (encoder_check (params))
+        return NULL;
+
+    stream = malloc ((num_frames * frame_words + PADDING_WORDS) * sizeof (uint32_t));
+
+    if (stream == NULL)
+        return NULL;
+
+    raw = stream;
+
+    for (size_t i = 0; i < num_frames; i++) {
+        const size_t num_words = encoder_encode_frame (params, pixels, i, raw);
+
+        if (!encoder_is_corrupt (params, i)) {
+            raw += num_words;
+            continue;
+        }
+
+        switch (next_random (&state) % NUM_CORRUPTIONS) {
+            case CORRUPT_HEADER:
+                raw[2] = ~raw[2];
+                raw += num_words;
+                break;
+            case CORRUPT_FOOTER:
+                raw[8 + get_payload_words (params) + 7] = 0;
+                raw += num_words;
+                break;
+            case CORRUPT_TRUNCATE:
+                raw += 8 + get_payload_words (params) / 16 * 8;
+                break;
+        }
+    }
+
+    memset (raw, 0, PADDING_WORDS * sizeof (uint32_t));
+    raw += PADDING_WORDS;
+
+    *num_bytes = (raw - stream) * sizeof (uint32_t);
+    return stream;
+}
@@ -0,0 +1,40 @@
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Geometry and content of a synthetic camera stream. Both data format versions
+ * are wrapped in a version 6 header, which is the only one carrying the output
+ * mode and ADC resolution.
+ */
+typedef struct {
+    int         version;        /* Data format version, 5 or 6 */
+    uint32_t    width;
+    uint32_t    height;
+    int         four_channels;  /* 4 channel output mode, version 5 only */
+    int         adc_bits;       /* 11 or 12, version 6 only */
+    uint16_t    start_address;  /* First sensor row, version 6 only */
+    size_t      num_fill_words; /* Fill words after each frame */
+    unsigned    corrupt_every;  /* Damage every n-th frame, 0 for none */
+    uint32_t    seed;
+} EncoderParams;
+
+void        encoder_params_init         (EncoderParams          *params);
+int         encoder_check               (const EncoderParams    *params);
+size_t      encoder_get_frame_words     (const EncoderParams    *params);
+void        encoder_fill_frame          (const EncoderParams    *params,
+                                         uint16_t               *pixels);
+size_t      encoder_encode_frame        (const EncoderParams    *params,
+                                         const uint16_t         *pixels,
+                                         uint32_t                frame_number,
+                                         uint32_t               *raw);
+uint32_t   *encoder_generate            (const EncoderParams    *params,
+                                         const uint16_t         *pixels,
+                                         size_t                  num_frames,
+                                         size_t                 *num_bytes);
+int         encoder_is_corrupt          (const EncoderParams    *params,
+                                         size_t                  frame);
+
+#endif
@@ -0,0 +1,521 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <ufodecode.h>
+#include "config.h"
+#include "encoder.h"
+#include "timer.h"
+
+/* Rows that corrupt payload blocks can address beyond a frame */
+static const size_t MAX_ROWS = 4098;
+
+/* Frames decoded per call of ufo_decoder_get_next_frames */
+#define BATCH_FRAMES 4
+
+static const char *kernels[] = { "none", "avx2", "avx512" };
+
+typedef struct {
+    EncoderParams params;
+    size_t num_frames;
+    unsigned max_threads;
+    double min_seconds;
+} Options;
+
+typedef struct {
+    UfoDecoder *decoder;
+    uint32_t *stream;
+    size_t num_bytes;
+    const uint16_t *frame;
+    uint16_t *pixels;
+    uint16_t *pixels2;
+    uint16_t *batch[BATCH_FRAMES];
+    uint8_t *rgb;
+    int width;
+    int height;
+} Bench;
+
+typedef void (*BenchFunc) (Bench *bench);
+
+static void
+usage(void)
+{
+    printf("usage: ipebench [OPTION]...\n\
+Measure the decoding kernels and frame processing functions on a synthetic\n\
+stream. Each result is the throughput of the input data and the time per frame.\n\
+Options:\n\
+  -h, --help                Show this help message and exit\n\
+  -n, --num-frames=N        Decode N frames per run (default: 16)\n\
+  -r, --num-rows=N          N rows per frame (default: 1088)\n\
+      --num-columns=N       N columns per frame (default: 2048)\n\
+      --version=N           Data format version 5 or 6 (default: 6)\n\
+      --four-channels       Use the 4 channel output mode of version 5\n\
+      --adc-bits=N          11 or 12 bit pixels of version 6 (default: 12)\n\
+      --fill-words=N        Put N fill words after each frame\n\
+      --corrupt=N           Damage every N-th frame\n\
+  -t, --threads=N           Measure up to N threads (default: one per CPU)\n\
+  -s, --seconds=S           Repeat each measurement for at least S seconds\n\
+                            (default: 1)\n");
+}
+
+static int
+is_kernel_supported(const char *kernel)
+{
+#if defined(HAVE_AVX2) && defined(__GNUC__)
+    if (!strcmp(kernel, "avx2"))
+        return __builtin_cpu_supports("avx2");
+#endif
+
+#if defined(HAVE_AVX512) && defined(__GNUC__)
+    if (!strcmp(kernel, "avx512"))
+        return __builtin_cpu_supports("avx512f");
+#endif
+
+    return !strcmp(kernel, "none");
+}
+
+/*
+ * Pixels of the first payload block of an 11-bit frame and the words they are
+ * packed into, worked out by hand rather than with the encoder. Each half
+ * holds eight 11-bit pixels MSB first, the lowest eight bits of its third word
+ * are unused. The encoder and decoder could agree on a wrong layout, but not
+ * with these.
+ */
+static const uint16_t golden_pixels_v6_11[16] = {
+    0x001, 0x002, 0x003, 0x004, 0x005, 0x006, 0x007, 0x008,
+    0x7ff, 0x400, 0x3ff, 0x001, 0x7fe, 0x2aa, 0x555, 0x7ff,
+};
+
+static const uint32_t golden_words_v6_11[6] = {
+    0x00200801, 0x80400a01, 0x80380800,
+    0xfff001ff, 0x801ffcaa, 0xaaafff00,
+};
+
+/*
+ * Check the encoder and the current kernels against golden_words_v6_11.
+ * Returns non-zero if either packs or unpacks the block differently.
+ */
+static int
+check_golden_v6_11(void)
+{
+    const size_t s = 128;
+    EncoderParams params;
+    UfoDecoder *decoder;
+    UfoDecoderMeta meta;
+    uint16_t *frame, *pixels;
+    uint32_t *raw;
+    int error = 0;
+
+    encoder_params_init(&params);
+    params.version = 6;
+    params.adc_bits = 11;
+    params.height = 16;
+
+    frame = calloc(params.width * params.height, sizeof(uint16_t));
+    pixels = calloc(params.width * params.height, sizeof(uint16_t));
+    raw = malloc(encoder_get_frame_words(&params) * sizeof(uint32_t));
+    decoder = ufo_decoder_new(params.height, params.width, NULL, 0);
+
+    if (frame == NULL || pixels == NULL || raw == NULL || decoder == NULL) {
+        error = ENOMEM;
+        goto out;
+    }
+
+    /* The second half goes into the next row or the next eight channels */
+    for (size_t c = 0; c < 8; c++) {
+        frame[c * s] = golden_pixels_v6_11[c];
+#ifdef HAVE_SSE
+        frame[params.width + c * s] = golden_pixels_v6_11[8 + c];
+#else
+        frame[(8 + c) * s] = golden_pixels_v6_11[8 + c];
+#endif
+    }
+
+    /* The first block follows the header and its row and pixel number */
+    encoder_encode_frame(&params, frame, 0, raw);
+
+    if (memcmp(raw + 10, golden_words_v6_11, sizeof(golden_words_v6_11))) {
+        fprintf(stderr, "ipebench: encoder packs 11-bit pixels incorrectly\n");
+        error = EILSEQ;
+        goto out;
+    }
+
+    /* The unused bits must not leak into the pixels */
+    raw[12] |= 0xff;
+    raw[15] |= 0xff;
+
+    if (ufo_decoder_decode_frame(decoder, raw, encoder_get_frame_words(&params) * sizeof(uint32_t), pixels, &meta) == 0 ||
+        memcmp(pixels, frame, params.width * params.height * sizeof(uint16_t)))
+        error = EILSEQ;
+
+out:
+    if (decoder != NULL)
+        ufo_decoder_free(decoder);
+
+    free(raw);
+    free(pixels);
+    free(frame);
+    return error;
+}
+
+/*
+ * Decode the whole stream once and compare the frames that were not damaged
+ * with the encoded pixels. Returns non-zero if a frame differs or none could
+ * be compared.
+ */
+static int
+check_frames(Bench *bench, const Options *opts)
+{
+    const size_t num_pixels = bench->width * bench->height;
+    UfoDecoderMeta meta;
+    int num_checked = 0;
+    int num_bad = 0;
+    int error;
+
+    ufo_decoder_set_raw_data(bench->decoder, bench->stream, bench->num_bytes);
+
+    do {
+        memset(bench->pixels, 0, num_pixels * sizeof(uint16_t));
+        error = ufo_decoder_get_next_frame(bench->decoder, &bench->pixels, &meta);
+
+        if (error == 0 && !encoder_is_corrupt(&opts->params, meta.frame_number)) {
+            num_checked++;
+
+            if (memcmp(bench->pixels, bench->frame, num_pixels * sizeof(uint16_t)))
+                num_bad++;
+        }
+    } while (error != EIO);
+
+    return num_bad > 0 || num_checked == 0;
+}
+
+/*
+ * Same as check_frames but decoding BATCH_FRAMES frames per call.
+ */
+static int
+check_batches(Bench *bench, const Options *opts)
+{
+    const size_t num_pixels = bench->width * bench->height;
+    UfoDecoderMeta meta[BATCH_FRAMES];
+    size_t num_decoded;
+    int num_checked = 0;
+    int num_bad = 0;
+    int error;
+
+    ufo_decoder_set_raw_data(bench->decoder, bench->stream, bench->num_bytes);
+
+    do {
+        for (size_t i = 0; i < BATCH_FRAMES; i++)
+            memset(bench->batch[i], 0, num_pixels * sizeof(uint16_t));
+
+        error = ufo_decoder_get_next_frames(bench->decoder, bench->batch, meta, BATCH_FRAMES, &num_decoded);
+
+        /* The last frame is corrupt on EILSEQ */
+        if (error == EILSEQ)
+            num_decoded--;
+
+        for (size_t i = 0; i < num_decoded; i++) {
+            if (encoder_is_corrupt(&opts->params, meta[i].frame_number))
+                continue;
+
+            num_checked++;
+
+            if (memcmp(bench->batch[i], bench->frame, num_pixels * sizeof(uint16_t)))
+                num_bad++;
+        }
+    } while (error != EIO);
+
+    return num_bad > 0 || num_checked == 0;
+}
+
+static void
+decode_stream(Bench *bench)
+{
+    UfoDecoderMeta meta;
+
+    ufo_decoder_set_raw_data(bench->decoder, bench->stream, bench->num_bytes);
+
+    while (ufo_decoder_get_next_frame(bench->decoder, &bench->pixels, &meta) != EIO)
+        ;
+}
+
+static void
+decode_batches(Bench *bench)
+{
+    UfoDecoderMeta meta[BATCH_FRAMES];
+    size_t num_decoded;
+
+    ufo_decoder_set_raw_data(bench->decoder, bench->stream, bench->num_bytes);
+
+    while (ufo_decoder_get_next_frames(bench->decoder, bench->batch, meta, BATCH_FRAMES, &num_decoded) != EIO)
+        ;
+}
+
+static void
+convert_bayer(Bench *bench)
+{
+    ufo_decoder_convert_bayer_to_rgb(bench->decoder, bench->frame, bench->rgb, bench->width, bench->height, 0);
+}
+
+static void
+interpolate(Bench *bench)
+{
+    ufo_decoder_deinterlace_interpolate(bench->decoder, bench->frame, bench->pixels2, bench->width, bench->height);
+}
+
+static void
+weave(Bench *bench)
+{
+    ufo_decoder_deinterlace_weave(bench->decoder, bench->frame, bench->frame, bench->pixels2, bench->width, bench->height);
+}
+
+/*
+ * Run func until min_seconds have passed and print the throughput of
+ * num_bytes input and the time per frame of num_frames frames per call.
+ */
+static void
+measure(const char *name, const char *kernel, unsigned num_threads, BenchFunc func, Bench *bench,
+        size_t num_bytes, size_t num_frames, const Options *opts)
+{
+    Timer *timer = timer_new();
+    size_t num_runs = 0;
+    double seconds;
+
+    func(bench);
+
+    do {
+        timer_start(timer);
+        func(bench);
+        timer_stop(timer);
+        num_runs++;
+    } while (timer_get_seconds(timer) < opts->min_seconds);
+
+    seconds = timer_get_seconds(timer);
+    printf("%-13s %-7s %3u   %8.3f GB/s   %12.0f ns/frame\n", name, kernel, num_threads,
+           num_bytes * num_runs / seconds / 1e9, seconds * 1e9 / (num_runs * num_frames));
+
+    timer_destroy(timer);
+}
+
+/*
+ * Create the decoder of bench with the given kernels, which also applies to
+ * the frame processing functions.
+ */
+static int
+setup_decoder(Bench *bench, const char *kernel, unsigned num_threads)
+{
+    if (kernel != NULL)
+        setenv("UFODECODE_SIMD", kernel, 1);
+    else
+        unsetenv("UFODECODE_SIMD");
+
+    if (bench->decoder != NULL)
+        ufo_decoder_free(bench->decoder);
+
+    bench->decoder = ufo_decoder_new(bench->height, bench->width, bench->stream, bench->num_bytes);
+
+    if (bench->decoder == NULL)
+        return EINVAL;
+
+    return ufo_decoder_set_num_threads(bench->decoder, num_threads);
+}
+
+static int
+run_benchmarks(Bench *bench, const Options *opts)
+{
+    const size_t frame_bytes = bench->width * bench->height * sizeof(uint16_t);
+    const size_t num_kernels = sizeof(kernels) / sizeof(kernels[0]);
+    int error;
+
+    for (size_t i = 0; i < num_kernels; i++) {
+        if (!is_kernel_supported(kernels[i]))
+            continue;
+
+        if ((error = setup_decoder(bench, kernels[i], 1)) != 0)
+            return error;
+
+        if (check_golden_v6_11() || check_frames(bench, opts) || check_batches(bench, opts)) {
+            fprintf(stderr, "ipebench: %s kernels decode frames incorrectly\n", kernels[i]);
+            return EILSEQ;
+        }
+
+        measure("decode", kernels[i], 1, decode_stream, bench, bench->num_bytes, opts->num_frames, opts);
+        measure("decode-batch", kernels[i], 1, decode_batches, bench, bench->num_bytes, opts->num_frames, opts);
+
+        /* There are no AVX-512 kernels for processing frames */
+        if (!strcmp(kernels[i], "avx512"))
+            continue;
+
+        measure("bayer", kernels[i], 1, convert_bayer, bench, frame_bytes, 1, opts);
+        measure("interpolate", kernels[i], 1, interpolate, bench, frame_bytes, 1, opts);
+        measure("weave", kernels[i], 1, weave, bench, 2 * frame_bytes, 1, opts);
+    }
+
+    for (unsigned num_threads = 2; num_threads < 2 * opts->max_threads; num_threads *= 2) {
+        if (num_threads > opts->max_threads)
+            num_threads = opts->max_threads;
+
+        if ((error = setup_decoder(bench, NULL, num_threads)) != 0)
+            return error;
+
+        measure("decode", "auto", num_threads, decode_stream, bench, bench->num_bytes, opts->num_frames, opts);
+        measure("decode-batch", "auto", num_threads, decode_batches, bench, bench->num_bytes, opts->num_frames, opts);
+        measure("bayer", "auto", num_threads, convert_bayer, bench, frame_bytes, 1, opts);
+        measure("interpolate", "auto", num_threads, interpolate, bench, frame_bytes, 1, opts);
+        measure("weave", "auto", num_threads, weave, bench, 2 * frame_bytes, 1, opts);
+
+        if (num_threads == opts->max_threads)
+            break;
+    }
+
+    return 0;
+}
+
+int main(int argc, char const* argv[])
+{
+    int getopt_ret, index;
+    uint16_t *frame;
+    Bench bench;
+    int error;
+
+    enum {
+        HELP         = 'h',
+        NUM_FRAMES   = 'n',
+        SET_NUM_ROWS = 'r',
+        SECONDS      = 's',
+        NUM_THREADS  = 't',
+        SET_NUM_COLUMNS = 256,
+        VERSION,
+        FOUR_CHANNELS,
+        ADC_BITS,
+        FILL_WORDS,
+        CORRUPT,
+    };
+
+    static struct option long_options[] = {
+        { "help",               no_argument, 0, HELP },
+        { "num-frames",         required_argument, 0, NUM_FRAMES },
+        { "num-rows",           required_argument, 0, SET_NUM_ROWS },
+        { "num-columns",        required_argument, 0, SET_NUM_COLUMNS },
+        { "version",            required_argument, 0, VERSION },
+        { "four-channels",      no_argument, 0, FOUR_CHANNELS },
+        { "adc-bits",           required_argument, 0, ADC_BITS },
+        { "fill-words",         required_argument, 0, FILL_WORDS },
+        { "corrupt",            required_argument, 0, CORRUPT },
+        { "threads",            required_argument, 0, NUM_THREADS },
+        { "seconds",            required_argument, 0, SECONDS },
+        { 0, 0, 0, 0 }
+    };
+
+    static Options opts = {
+        .num_frames = 16,
+        .max_threads = 0,
+        .min_seconds = 1.0
+    };
+
+    encoder_params_init(&opts.params);
+
+    while ((getopt_ret = getopt_long(argc, (char *const *) argv, "hn:r:s:t:", long_options, &index)) != -1) {
+        switch (getopt_ret) {
+            case HELP:
+                usage();
+                return 0;
+            case NUM_FRAMES:
+                opts.num_frames = atoi(optarg);
+                break;
+            case SET_NUM_ROWS:
+                opts.params.height = atoi(optarg);
+                break;
+            case SET_NUM_COLUMNS:
+                opts.params.width = atoi(optarg);
+                break;
+            case VERSION:
+                opts.params.version = atoi(optarg);
+                break;
+            case FOUR_CHANNELS:
+                opts.params.four_channels = 1;
+                break;
+            case ADC_BITS:
+                opts.params.adc_bits = atoi(optarg);
+                break;
+            case FILL_WORDS:
+                opts.params.num_fill_words = atoi(optarg);
+                break;
+            case CORRUPT:
+                opts.params.corrupt_every = atoi(optarg);
+                break;
+            case NUM_THREADS:
+                opts.max_threads = atoi(optarg);
+                break;
+            case SECONDS:
+                opts.min_seconds = atof(optarg);
+                break;
+            default:
+                return 1;
+        }
+    }
+
+    if (opts.max_threads == 0) {
+        const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        opts.max_threads = num_cpus > 0 ? num_cpus : 1;
+    }
+
+    if (encoder_check(&opts.params) || opts.num_frames == 0) {
+        fprintf(stderr, "ipebench: frames of this geometry cannot be encoded\n");
+        return 1;
+    }
+
+    memset(&bench, 0, sizeof(Bench));
+    bench.width = opts.params.width;
+    bench.height = opts.params.height;
+
+    frame = malloc(bench.width * bench.height * sizeof(uint16_t));
+    bench.pixels = malloc(bench.width * MAX_ROWS * sizeof(uint16_t));
+    bench.pixels2 = malloc(2 * bench.width * bench.height * sizeof(uint16_t));
+    bench.rgb = malloc(3 * bench.width * bench.height);
+
+    if (frame == NULL || bench.pixels == NULL || bench.pixels2 == NULL || bench.rgb == NULL) {
+        error = ENOMEM;
+        goto out;
+    }
+
+    for (size_t i = 0; i < BATCH_FRAMES; i++) {
+        bench.batch[i] = malloc(bench.width * MAX_ROWS * sizeof(uint16_t));
+
+        if (bench.batch[i] == NULL) {
+            error = ENOMEM;
+            goto out;
+        }
+    }
+
+    encoder_fill_frame(&opts.params, frame);
+    bench.frame = frame;
+    bench.stream = encoder_generate(&opts.params, frame, opts.num_frames, &bench.num_bytes);
+
+    if (bench.stream == NULL) {
+        error = ENOMEM;
+        goto out;
+    }
+
+    printf("v%i %ix%i, %zu frames, %.1f MB\n", opts.params.version, bench.width, bench.height,
+           opts.num_frames, bench.num_bytes / 1e6);
+
+    error = run_benchmarks(&bench, &opts);
+
+out:
+    if (bench.decoder != NULL)
+        ufo_decoder_free(bench.decoder);
+
+    for (size_t i = 0; i < BATCH_FRAMES; i++)
+        free(bench.batch[i]);
+
+    free(bench.stream);
+    free(bench.rgb);
+    free(bench.pixels2);
+    free(bench.pixels);
+    free(frame);
+    return error;
+}
@@ -5,10 +5,19 @@
 #include <unistd.h>
 #include <errno.h>
 #include <getopt.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <ufodecode.h>
 #include "timer.h"
+#include "writer.h"
 
-static const int MAX_ROWS = 3842;
+
+/* Part of a mapped file that is requested ahead of the decoder */
+static const size_t WINDOW_SIZE = 256 * 1024 * 1024;
+
+/* Size of the blocks read from standard input */
+static const size_t STREAM_BLOCK_SIZE = 4 * 1024 * 1024;
 
 typedef struct {
     int clear_frame;
@@ -20,8 +29,36 @@ typedef struct {
     int print_num_rows;
     int cont;
     int convert_bayer;
+    int format;             /* Stage converting the pixels or -1 */
+    int shift;              /* Shift of 8 bit pixels or -1 */
+    int num_threads;
+    int parallel_frames;
+    int read_stdin;
+    int direct_io;
+    int meta_only;
+    int output_fd;
+    unsigned roi_x;
+    unsigned roi_y;
+    unsigned roi_width;
+    unsigned roi_height;
 } Options;
 
+typedef struct {
+    UfoDecoder *decoder;
+    UfoPipeline *pipeline;
+    Writer     *writer;
+    int         n_frames;
+    uint32_t    old_time_stamp;
+} Output;
+
+typedef struct {
+    char   *data;
+    size_t  length;
+    int     mapped;
+    size_t  window_start;
+    size_t  window_end;
+} RawFile;
+
 
 static int
 read_raw_file(const char *filename, char **buffer, size_t *length)
@@ -50,21 +87,106 @@ read_raw_file(const char *filename, char **buffer, size_t *length)
     return 0;
 }
 
+/*
+ * Map the file into memory instead of reading it, so that large captures need
+ * not fit into RAM and decoding can start right away. Only a window of the
+ * file ahead of the decoder is requested from the kernel, which is moved by
+ * advance_window.
+ */
+static int
+open_raw_file (const char *filename, RawFile *file)
+{
+    struct stat st;
+    int fd;
+
+    file->mapped = 0;
+    file->window_start = 0;
+    file->window_end = 0;
+
+    fd = open (filename, O_RDONLY);
+
+    if (fd < 0)
+        return errno;
+
+    if (fstat (fd, &st) || (st.st_size == 0)) {
+        close (fd);
+        return read_raw_file (filename, &file->data, &file->length);
+    }
+
+    file->length = st.st_size;
+    file->data = mmap (NULL, file->length, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+
+    if (file->data == MAP_FAILED)
+        return read_raw_file (filename, &file->data, &file->length);
+
+    file->mapped = 1;
+    file->window_end = file->length < WINDOW_SIZE ? file->length : WINDOW_SIZE;
+    madvise (file->data, file->length, MADV_SEQUENTIAL);
+    madvise (file->data, file->window_end, MADV_WILLNEED);
+    return 0;
+}
+
+/*
+ * Release the pages the decoder is done with once it is half way through the
+ * window and request the next window.
+ */
+static void
+advance_window (RawFile *file, size_t pos)
+{
+    const size_t page_size = sysconf (_SC_PAGESIZE);
+    size_t start;
+
+    if (!file->mapped || (pos < file->window_start + WINDOW_SIZE / 2) || (pos >= file->length))
+        return;
+
+    start = pos & ~(page_size - 1);
+    madvise (file->data + file->window_start, start - file->window_start, MADV_DONTNEED);
+
+    file->window_start = start;
+    file->window_end = file->length - start < WINDOW_SIZE ? file->length : start + WINDOW_SIZE;
+    madvise (file->data + start, file->window_end - start, MADV_WILLNEED);
+}
+
+static void
+close_raw_file (RawFile *file)
+{
+    if (file->mapped)
+        munmap (file->data, file->length);
+    else
+        free (file->data);
+}
+
 static void
 usage(void)
 {
     printf("usage: ipedec [OPTION]... FILE [FILE ...]\n\
+With FILE being -, frames are read from standard input and saved in stdin.raw.\n\
+With --output=-, frames are written to standard output and messages go to\n\
+standard error.\n\
 Options:\n\
   -h, --help                Show this help message and exit\n\
   -v, --verbose             Print additional information on STDOUT\n\
   -r, --num-rows=N          N rows contained in the file\n\
       --num-columns=N       N columns contained in the file\n\
+      --roi=X,Y,W,H         Only decode and save W x H pixels at column X and\n\
+                            row Y\n\
   -c, --clear-frame         Clear the frame for each iteration\n\
   -d, --dry-run             Do not save the frames\n\
+  -m, --meta-only           Only read headers and footers of the frames in\n\
+                            FILE, which implies --dry-run\n\
   -f, --print-frame-rate    Print frame rate on STDOUT\n\
       --print-num-rows      Print number of rows on STDOUT\n\
       --continue            Continue decoding frames even when errors occur\n\
-      --convert-bayer       Convert Bayer pattern to 24 Bit RGB\n");
+      --convert-bayer       Convert Bayer pattern to 24 Bit RGB\n\
+      --format=FORMAT       Save pixels as uint16 (default), packed12 (two\n\
+                            pixels in three bytes), uint8 or float32\n\
+      --shift=N             Drop the lowest N bits of uint8 pixels (default: 4)\n\
+  -t, --threads=N           Decode each frame with N threads (0: one per CPU)\n\
+  -p, --parallel-frames     Decode one frame per thread at once instead\n\
+      --stdin               Read frames from standard input\n\
+      --direct              Write frames with O_DIRECT, bypassing the page cache\n\
+      --output=-            Write frames to standard output instead of FILE.raw\n");
 }
 
 static void
@@ -106,24 +228,226 @@ print_meta_data (UfoDecoderMeta *meta)
     printf("\n");
 }
 
+/*
+ * Size of a decoded frame, which is the region of interest if one is set.
+ * Rows beyond those of the decoder were dropped.
+ */
+static void
+get_frame_size (UfoDecoder *decoder, Options *opts, UfoDecoderMeta *meta, size_t *width, size_t *height)
+{
+    const size_t num_rows = ufo_decoder_get_num_rows (decoder);
+
+    if (opts->roi_width > 0) {
+        *width = opts->roi_width;
+        *height = opts->roi_height;
+    }
+    else {
+        *width = opts->num_columns;
+        *height = meta->n_rows < num_rows ? meta->n_rows : num_rows;
+    }
+}
+
 static void
 write_raw_file (UfoDecoderMeta *meta,
                 Options *opts,
                 uint16_t *pixels,
-                FILE *fp)
+                Output *out)
 {
-    size_t n_rows = meta->n_rows;
+    size_t width, n_rows;
+    void *buffer = writer_get_buffer (out->writer);
+
+    get_frame_size (out->decoder, opts, meta, &width, &n_rows);
 
     if (opts->convert_bayer) {
-        uint8_t *rgb_pixels = malloc (opts->num_columns * n_rows * 3);
+        ufo_decoder_convert_bayer_to_rgb (out->decoder, pixels, buffer, width, n_rows, 0);
+        writer_submit (out->writer, width * n_rows * 3);
+    }
+    else if (out->pipeline) {
+        ufo_pipeline_process (out->pipeline, pixels, width, n_rows, buffer);
+        writer_submit (out->writer, ufo_pipeline_get_output_size (out->pipeline, width, n_rows));
+    }
+    else {
+        memcpy (buffer, pixels, width * n_rows * sizeof(uint16_t));
+        writer_submit (out->writer, width * n_rows * sizeof(uint16_t));
+    }
+}
+
+static UfoDecoder *
+create_decoder (Options *opts, char *data, size_t length)
+{
+    UfoDecoder *decoder;
 
-        ufo_convert_bayer_to_rgb (pixels, rgb_pixels, opts->num_columns, n_rows);
-        fwrite (rgb_pixels, sizeof(uint8_t), opts->num_columns * n_rows * 3, fp);
-        free (rgb_pixels);
+    decoder = ufo_decoder_new (opts->num_rows, opts->num_columns, (uint32_t *) data, length);
+
+    if (decoder == NULL) {
+        fprintf(stderr, "Failed to initialize decoder\n");
+        return NULL;
+    }
+
+    if (ufo_decoder_set_num_threads (decoder, opts->num_threads)) {
+        fprintf(stderr, "Failed to set up decoding threads\n");
+        ufo_decoder_free (decoder);
+        return NULL;
+    }
+
+    if (opts->roi_width > 0 &&
+        ufo_decoder_set_roi (decoder, opts->roi_x, opts->roi_y, opts->roi_width, opts->roi_height)) {
+        fprintf(stderr, "Region of interest does not fit into the frames\n");
+        ufo_decoder_free (decoder);
+        return NULL;
+    }
+
+    if (opts->parallel_frames && ufo_decoder_set_frames_ahead (decoder, 0)) {
+        fprintf(stderr, "Failed to allocate frame buffers\n");
+        ufo_decoder_free (decoder);
+        return NULL;
+    }
+
+    ufo_decoder_set_timing (decoder, opts->verbose);
+    return decoder;
+}
+
+static int
+open_output (Output *out, Options *opts, UfoDecoder *decoder, const char *name)
+{
+    const size_t frame_size = opts->num_columns * ufo_decoder_get_num_rows (decoder) * sizeof(float);
+    char output_name[256];
+
+    out->decoder = decoder;
+    out->n_frames = 0;
+    out->old_time_stamp = 0;
+    out->pipeline = NULL;
+    out->writer = NULL;
+
+    if (opts->dry_run)
+        return 0;
+
+    if (opts->format >= 0) {
+        out->pipeline = ufo_pipeline_new (decoder);
+
+        if (!out->pipeline || ufo_pipeline_add_stage (out->pipeline, opts->format)) {
+            fprintf(stderr, "Failed to set up the pixel format\n");
+            ufo_pipeline_free (out->pipeline);
+            out->pipeline = NULL;
+            return 1;
+        }
+
+        if (opts->shift >= 0)
+            ufo_pipeline_set_shift (out->pipeline, opts->shift);
+    }
+
+    /* Large enough for frames of RGB or float pixels */
+    if (opts->output_fd >= 0) {
+        out->writer = writer_new_for_fd (opts->output_fd, frame_size);
     }
     else {
-        fwrite(pixels, sizeof(uint16_t), opts->num_columns * n_rows, fp);
+        snprintf(output_name, 256, "%s.raw", name);
+        out->writer = writer_new (output_name, frame_size, opts->direct_io);
+    }
+
+    if (!out->writer) {
+        fprintf(stderr, "Failed to open file for writing\n");
+        ufo_pipeline_free (out->pipeline);
+        out->pipeline = NULL;
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Finish writing and return an error that occurred while doing so.
+ */
+static int
+close_output (Output *out, Options *opts, Timer *timer)
+{
+    int error = 0;
+    double stall = 0.0;
+
+    if (out->writer) {
+        stall = writer_get_stall_seconds (out->writer);
+        error = writer_free (out->writer);
+
+        if (error)
+            fprintf(stderr, "Failed to write frames: %s\n", strerror(error));
     }
+
+    ufo_pipeline_free (out->pipeline);
+
+    if (opts->verbose) {
+        UfoDecoderStats stats;
+
+        ufo_decoder_get_stats (out->decoder, &stats);
+
+        printf("Decoded %i frames in %.5fms\n", out->n_frames,
+               timer_get_seconds (timer) * 1000.0);
+        printf("Waited %.5fms for writing frames\n", stall * 1000.0);
+        printf("Consumed %" PRIu64 " bytes: %" PRIu64 " frames, %" PRIu64 " corrupt frames, "
+               "%" PRIu64 " words skipped to resync, %" PRIu64 " fill words\n",
+               stats.num_bytes, stats.num_frames, stats.num_corrupt_frames,
+               stats.num_resync_words, stats.num_fill_words);
+        printf("Spent %.5fms on headers, %.5fms on payloads, %.5fms searching frames\n",
+               stats.header_ns / 1e6, stats.payload_ns / 1e6, stats.scan_ns / 1e6);
+    }
+
+    return error;
+}
+
+/*
+ * Report and save a frame that was decoded with the given error code. Returns
+ * non-zero if decoding should stop.
+ */
+static int
+handle_frame (Output *out, Options *opts, int error, UfoDecoderMeta *meta, uint16_t *frame)
+{
+    if (meta->n_rows == 0)
+        meta->n_rows = opts->num_rows;
+
+    if (!error) {
+        out->n_frames++;
+
+        if (opts->verbose) {
+            printf("Status for frame %i\n", out->n_frames);
+            print_meta_data (meta);
+        }
+
+        if (opts->print_frame_rate) {
+            uint32_t diff = 80 * (meta->time_stamp - out->old_time_stamp);
+
+            /* Time stamps of consecutive frames may be equal */
+            printf("%-6d", diff ? 1000000000 / diff : 0);
+            out->old_time_stamp = meta->time_stamp;
+        }
+
+        if (opts->print_num_rows)
+            printf ("%d", meta->n_rows);
+
+        if (opts->print_frame_rate || opts->print_num_rows)
+            printf ("\n");
+
+        if (opts->clear_frame) {
+            size_t width, n_rows;
+
+            get_frame_size (out->decoder, opts, meta, &width, &n_rows);
+            memset (frame, 0, width * n_rows * sizeof(uint16_t));
+        }
+
+        if (!opts->dry_run)
+            write_raw_file (meta, opts, frame, out);
+
+        return 0;
+    }
+
+    fprintf(stderr, "Failed to decode frame %i\n", out->n_frames);
+
+    if (!opts->cont)
+        return error;
+
+    /* Save the frame even though we know it is corrupted */
+    if (!opts->dry_run)
+        write_raw_file (meta, opts, frame, out);
+
+    return 0;
 }
 
 static int
@@ -132,125 +456,198 @@ process_file(const char *filename, Options *opts)
     UfoDecoder      *decoder;
     UfoDecoderMeta   meta = {0};
     Timer           *timer;
-    char            *buffer;
-    size_t           num_bytes;
+    RawFile          file;
+    Output           out;
     uint16_t        *pixels;
-    uint32_t         time_stamp, old_time_stamp;
-    int              n_frames;
+    uint16_t        *frame;
     int              error = 0;
-    FILE            *fp;
-    char             output_name[256];
-    float            mtime;
 
-    error = read_raw_file (filename, &buffer, &num_bytes);
+    error = open_raw_file (filename, &file);
 
     if (error) {
         fprintf(stderr, "Error reading %s: %s\n", filename, strerror(error));
         return error;
     }
 
-    decoder = ufo_decoder_new (opts->num_rows, opts->num_columns, (uint32_t *) buffer, num_bytes);
+    timer = timer_new ();
+    decoder = create_decoder (opts, file.data, file.length);
 
     if (decoder == NULL) {
-        fprintf(stderr, "Failed to initialize decoder\n");
-        return 1;
+        error = 1;
+        goto out;
     }
 
-    if (!opts->dry_run) {
-        snprintf(output_name, 256, "%s.raw", filename);
-        fp = fopen(output_name, "wb");
+    /* Owned by the decoder and large enough for every frame it produces */
+    pixels = ufo_decoder_acquire_frame (decoder);
 
-        if (!fp) {
-            fprintf(stderr, "Failed to open file for writing\n");
-            return 1;
-        }
+    if (pixels == NULL) {
+        fprintf(stderr, "Failed to allocate the frame\n");
+        error = ENOMEM;
+        goto out;
     }
 
-    timer = timer_new ();
-    pixels = (uint16_t *) malloc (opts->num_columns * MAX_ROWS * sizeof(uint16_t));
-    n_frames = 0;
-    old_time_stamp = 0;
+    if (open_output (&out, opts, decoder, filename)) {
+        error = 1;
+        goto out;
+    }
 
     while (error != EIO) {
         timer_start (timer);
-        error = ufo_decoder_get_next_frame (decoder, &pixels, &meta);
+        frame = pixels;
 
-        if (meta.n_rows == 0)
-            meta.n_rows = opts->num_rows;
+        if (opts->meta_only)
+            error = ufo_decoder_get_next_meta (decoder, &meta);
+        else if (opts->parallel_frames)
+            error = ufo_decoder_get_next_frame_buffer (decoder, &frame, &meta);
+        else
+            error = ufo_decoder_get_next_frame (decoder, &frame, &meta);
 
         timer_stop (timer);
+        advance_window (&file, ufo_decoder_get_position (decoder));
+
+        if (error != EIO && handle_frame (&out, opts, error, &meta, frame))
+            break;
+    }
+
+    if (error == EIO)
+        error = 0;
+
+    if (close_output (&out, opts, timer) && !error)
+        error = EIO;
+
+out:
+    close_raw_file (&file);
+    timer_destroy (timer);
+
+    if (decoder != NULL)
+        ufo_decoder_free(decoder);
+
+    return error;
+}
+
+/*
+ * Read blocks from standard input and decode frames as soon as they are
+ * complete. The decoder keeps what is left of a frame at the end of a block,
+ * so two blocks are enough: one that is decoded and one that is read into
+ * next.
+ */
+static int
+process_stream (Options *opts)
+{
+    UfoDecoder      *decoder;
+    UfoDecoderMeta   meta = {0};
+    Timer           *timer;
+    Output           out;
+    char            *blocks[2];
+    uint16_t        *pixels;
+    int              current = 0;
+    int              error = 0;
 
-        if (!error) {
-            n_frames++;
+    timer = timer_new ();
+    blocks[0] = malloc (STREAM_BLOCK_SIZE);
+    blocks[1] = malloc (STREAM_BLOCK_SIZE);
+    decoder = create_decoder (opts, NULL, 0);
 
-            if (opts->verbose) {
-                printf("Status for frame %i\n", n_frames);
-                print_meta_data (&meta);
-            }
+    if (decoder == NULL) {
+        error = 1;
+        goto out;
+    }
 
-            if (opts->print_frame_rate) {
-                uint32_t diff = 80 * (meta.time_stamp - old_time_stamp);
+    pixels = ufo_decoder_acquire_frame (decoder);
 
-                printf("%-6d", 1000000000 / diff);
-                old_time_stamp = meta.time_stamp;
-            }
+    if (pixels == NULL || blocks[0] == NULL || blocks[1] == NULL) {
+        fprintf(stderr, "Failed to allocate the frame\n");
+        error = ENOMEM;
+        goto out;
+    }
 
-            if (opts->print_num_rows)
-                printf ("%d", meta.n_rows);
+    if (open_output (&out, opts, decoder, "stdin")) {
+        error = 1;
+        goto out;
+    }
 
-            if (opts->print_frame_rate || opts->print_num_rows)
-                printf ("\n");
+    while (!error) {
+        char *block = blocks[current];
+        size_t num_bytes = 0;
+        ssize_t n = 0;
 
-            if (opts->clear_frame)
-                memset (pixels, 0, opts->num_columns * meta.n_rows * sizeof(uint16_t));
+        /* Fill the block completely so that it ends on a word boundary */
+        while (num_bytes < STREAM_BLOCK_SIZE) {
+            n = read (STDIN_FILENO, block + num_bytes, STREAM_BLOCK_SIZE - num_bytes);
 
-            if (!opts->dry_run)
-                write_raw_file (&meta, opts, pixels, fp);
+            if (n > 0)
+                num_bytes += n;
+            else if (n == 0 || errno != EINTR)
+                break;
         }
-        else if (error != EIO) {
-            fprintf(stderr, "Failed to decode frame %i\n", n_frames);
-
-            if (opts->cont) {
-                /* Save the frame even though we know it is corrupted */
-                if (!opts->dry_run)
-                    write_raw_file (&meta, opts, pixels, fp);
-            }
-            else
+
+        if (n < 0)
+            error = errno;
+
+        if (error || num_bytes == 0)
+            break;
+
+        current = 1 - current;
+        timer_start (timer);
+        error = ufo_decoder_push_data (decoder, (uint32_t *) block, num_bytes);
+        timer_stop (timer);
+
+        while (!error) {
+            int decode_error;
+
+            timer_start (timer);
+            decode_error = ufo_decoder_pop_frame (decoder, &pixels, &meta);
+            timer_stop (timer);
+
+            if (decode_error == EAGAIN)
                 break;
+
+            error = handle_frame (&out, opts, decode_error, &meta, pixels);
         }
     }
 
-    if (!opts->dry_run)
-        fclose(fp);
+    if (error)
+        fprintf(stderr, "Error decoding standard input: %s\n", strerror(error));
 
-    if (opts->verbose) {
-        printf("Decoded %i frames in %.5fms\n", n_frames,
-               timer_get_seconds (timer) * 1000.0);
-    }
+    if (close_output (&out, opts, timer) && !error)
+        error = EIO;
 
-    free(pixels);
-    free(buffer);
+out:
+    free(blocks[0]);
+    free(blocks[1]);
     timer_destroy (timer);
-    ufo_decoder_free(decoder);
 
-    return error == EIO ? 0 : error;
+    if (decoder != NULL)
+        ufo_decoder_free(decoder);
+
+    return error;
 }
 
 int main(int argc, char const* argv[])
 {
     int getopt_ret, index;
+    int output_stdout = 0;
 
     enum {
         CLEAR_FRAME  = 'c',
         DRY_RUN      = 'd',
         FRAME_RATE   = 'f',
         HELP         = 'h',
+        META_ONLY    = 'm',
         SET_NUM_ROWS = 'r',
+        PARALLEL_FRAMES = 'p',
+        NUM_THREADS  = 't',
         VERBOSE      = 'v',
         CONTINUE,
         NUM_ROWS,
         SET_NUM_COLUMNS,
         CONVERT_BAYER,
+        READ_STDIN,
+        DIRECT_IO,
+        OUTPUT,
+        ROI,
+        FORMAT,
+        SHIFT,
     };
 
     static struct option long_options[] = {
@@ -260,10 +657,19 @@ int main(int argc, char const* argv[])
         { "verbose",            no_argument, 0, VERBOSE },
         { "help",               no_argument, 0, HELP },
         { "dry-run",            no_argument, 0, DRY_RUN },
+        { "meta-only",          no_argument, 0, META_ONLY },
         { "print-frame-rate",   no_argument, 0, FRAME_RATE },
         { "continue",           no_argument, 0, CONTINUE },
         { "print-num-rows",     no_argument, 0, NUM_ROWS },
         { "convert-bayer",      no_argument, 0, CONVERT_BAYER },
+        { "threads",            required_argument, 0, NUM_THREADS },
+        { "parallel-frames",    no_argument, 0, PARALLEL_FRAMES },
+        { "stdin",              no_argument, 0, READ_STDIN },
+        { "direct",             no_argument, 0, DIRECT_IO },
+        { "output",             required_argument, 0, OUTPUT },
+        { "roi",                required_argument, 0, ROI },
+        { "format",             required_argument, 0, FORMAT },
+        { "shift",              required_argument, 0, SHIFT },
         { 0, 0, 0, 0 }
     };
 
@@ -276,10 +682,19 @@ int main(int argc, char const* argv[])
         .print_frame_rate = 0,
         .print_num_rows = 0,
         .cont = 0,
-        .convert_bayer = 0
+        .convert_bayer = 0,
+        .format = -1,
+        .shift = -1,
+        .num_threads = 1,
+        .parallel_frames = 0,
+        .read_stdin = 0,
+        .direct_io = 0,
+        .meta_only = 0,
+        .output_fd = -1,
+        .roi_width = 0
     };
 
-    while ((getopt_ret = getopt_long(argc, (char *const *) argv, "r:cvhdf", long_options, &index)) != -1) {
+    while ((getopt_ret = getopt_long(argc, (char *const *) argv, "r:t:pcvhdfm", long_options, &index)) != -1) {
         switch (getopt_ret) {
             case SET_NUM_ROWS:
                 opts.num_rows = atoi(optarg);
@@ -299,6 +714,9 @@ int main(int argc, char const* argv[])
             case DRY_RUN:
                 opts.dry_run = 1;
                 break;
+            case META_ONLY:
+                opts.meta_only = 1;
+                break;
             case FRAME_RATE:
                 opts.print_frame_rate = 1;
                 break;
@@ -311,18 +729,91 @@ int main(int argc, char const* argv[])
             case CONVERT_BAYER:
                 opts.convert_bayer = 1;
                 break;
+            case NUM_THREADS:
+                opts.num_threads = atoi(optarg);
+                break;
+            case PARALLEL_FRAMES:
+                opts.parallel_frames = 1;
+                break;
+            case READ_STDIN:
+                opts.read_stdin = 1;
+                break;
+            case DIRECT_IO:
+                opts.direct_io = 1;
+                break;
+            case OUTPUT:
+                if (strcmp(optarg, "-")) {
+                    fprintf(stderr, "ipedec: only standard output (-) is supported as output\n");
+                    return 1;
+                }
+
+                output_stdout = 1;
+                break;
+            case ROI:
+                if (sscanf(optarg, "%u,%u,%u,%u", &opts.roi_x, &opts.roi_y, &opts.roi_width, &opts.roi_height) != 4 ||
+                    opts.roi_width == 0 || opts.roi_height == 0) {
+                    fprintf(stderr, "ipedec: region of interest must be given as X,Y,WIDTH,HEIGHT\n");
+                    return 1;
+                }
+                break;
+            case FORMAT:
+                if (!strcmp(optarg, "uint16"))
+                    opts.format = -1;
+                else if (!strcmp(optarg, "packed12"))
+                    opts.format = UFO_STAGE_PACK_12;
+                else if (!strcmp(optarg, "uint8"))
+                    opts.format = UFO_STAGE_TO_8_BIT;
+                else if (!strcmp(optarg, "float32"))
+                    opts.format = UFO_STAGE_TO_FLOAT;
+                else {
+                    fprintf(stderr, "ipedec: unknown pixel format %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case SHIFT:
+                opts.shift = atoi(optarg);
+                break;
             default:
                 break;
         }
     }
 
+    if (opts.convert_bayer && opts.format >= 0) {
+        fprintf(stderr, "ipedec: --convert-bayer and --format cannot be combined\n");
+        return 1;
+    }
+
+    /* There are no pixels to save or clear */
+    if (opts.meta_only) {
+        opts.dry_run = 1;
+        opts.clear_frame = 0;
+    }
+
+    /*
+     * Frames go to the original standard output while everything printed is
+     * redirected to standard error, so the two do not mix.
+     */
+    if (output_stdout && !opts.dry_run) {
+        fflush(stdout);
+        opts.output_fd = dup(STDOUT_FILENO);
+
+        if (opts.output_fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            fprintf(stderr, "ipedec: cannot redirect standard output: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+
+    if (opts.read_stdin)
+        return process_stream(&opts);
+
     if (optind == argc) {
         printf("ipedec: no input files\n");
         return 1;
     }
 
     while (optind < argc) {
-        int errcode = process_file(argv[optind++], &opts);
+        const char *filename = argv[optind++];
+        int errcode = strcmp(filename, "-") ? process_file(filename, &opts) : process_stream(&opts);
 
         if (errcode != 0)
             return errcode;
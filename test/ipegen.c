@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include "encoder.h"
+
+static void
+usage(void)
+{
+    printf("usage: ipegen [OPTION]... FILE\n\
+Write a synthetic camera stream to FILE, which ipedec decodes into frames of\n\
+random pixels. With FILE being -, the stream is written to standard output.\n\
+Options:\n\
+  -h, --help                Show this help message and exit\n\
+  -n, --num-frames=N        Write N frames (default: 16)\n\
+  -r, --num-rows=N          N rows per frame (default: 1088)\n\
+      --num-columns=N       N columns per frame (default: 2048)\n\
+      --version=N           Data format version 5 or 6 (default: 6)\n\
+      --four-channels       Use the 4 channel output mode of version 5\n\
+      --adc-bits=N          11 or 12 bit pixels of version 6 (default: 12)\n\
+      --start-address=N     First sensor row of version 6 frames\n\
+      --fill-words=N        Put N fill words after each frame\n\
+      --corrupt=N           Damage every N-th frame\n\
+      --seed=N              Seed of the pixel values\n\
+      --pixels=FILE         Also write the pixels of a frame to FILE\n");
+}
+
+static int
+write_file(const char *filename, const void *data, size_t num_bytes)
+{
+    FILE *fp = strcmp(filename, "-") ? fopen(filename, "wb") : stdout;
+    int error = 0;
+
+    if (fp == NULL)
+        return errno;
+
+    if (fwrite(data, 1, num_bytes, fp) != num_bytes)
+        error = EIO;
+
+    if (fp != stdout)
+        fclose(fp);
+
+    return error;
+}
+
+int main(int argc, char const* argv[])
+{
+    int getopt_ret, index;
+    size_t num_frames = 16;
+    const char *pixels_filename = NULL;
+    EncoderParams params;
+    uint16_t *pixels;
+    uint32_t *stream;
+    size_t num_bytes;
+    int error;
+
+    enum {
+        HELP         = 'h',
+        NUM_FRAMES   = 'n',
+        SET_NUM_ROWS = 'r',
+        SET_NUM_COLUMNS = 256,
+        VERSION,
+        FOUR_CHANNELS,
+        ADC_BITS,
+        START_ADDRESS,
+        FILL_WORDS,
+        CORRUPT,
+        SEED,
+        PIXELS,
+    };
+
+    static struct option long_options[] = {
+        { "help",               no_argument, 0, HELP },
+        { "num-frames",         required_argument, 0, NUM_FRAMES },
+        { "num-rows",           required_argument, 0, SET_NUM_ROWS },
+        { "num-columns",        required_argument, 0, SET_NUM_COLUMNS },
+        { "version",            required_argument, 0, VERSION },
+        { "four-channels",      no_argument, 0, FOUR_CHANNELS },
+        { "adc-bits",           required_argument, 0, ADC_BITS },
+        { "start-address",      required_argument, 0, START_ADDRESS },
+        { "fill-words",         required_argument, 0, FILL_WORDS },
+        { "corrupt",            required_argument, 0, CORRUPT },
+        { "seed",               required_argument, 0, SEED },
+        { "pixels",             required_argument, 0, PIXELS },
+        { 0, 0, 0, 0 }
+    };
+
+    encoder_params_init(&params);
+
+    while ((getopt_ret = getopt_long(argc, (char *const *) argv, "hn:r:", long_options, &index)) != -1) {
+        switch (getopt_ret) {
+            case HELP:
+                usage();
+                return 0;
+            case NUM_FRAMES:
+                num_frames = atoi(optarg);
+                break;
+            case SET_NUM_ROWS:
+                params.height = atoi(optarg);
+                break;
+            case SET_NUM_COLUMNS:
+                params.width = atoi(optarg);
+                break;
+            case VERSION:
+                params.version = atoi(optarg);
+                break;
+            case FOUR_CHANNELS:
+                params.four_channels = 1;
+                break;
+            case ADC_BITS:
+                params.adc_bits = atoi(optarg);
+                break;
+            case START_ADDRESS:
+                params.start_address = atoi(optarg);
+                break;
+            case FILL_WORDS:
+                params.num_fill_words = atoi(optarg);
+                break;
+            case CORRUPT:
+                params.corrupt_every = atoi(optarg);
+                break;
+            case SEED:
+                params.seed = strtoul(optarg, NULL, 0);
+                break;
+            case PIXELS:
+                pixels_filename = optarg;
+                break;
+            default:
+                return 1;
+        }
+    }
+
+    if (optind + 1 != argc) {
+        fprintf(stderr, "ipegen: expected one output file\n");
+        return 1;
+    }
+
+    if (encoder_check(&params)) {
+        fprintf(stderr, "ipegen: frames of this geometry cannot be encoded\n");
+        return 1;
+    }
+
+    pixels = malloc(params.width * params.height * sizeof(uint16_t));
+
+    if (pixels == NULL)
+        return ENOMEM;
+
+    encoder_fill_frame(&params, pixels);
+    stream = encoder_generate(&params, pixels, num_frames, &num_bytes);
+
+    if (stream == NULL) {
+        free(pixels);
+        return ENOMEM;
+    }
+
+    error = write_file(argv[optind], stream, num_bytes);
+
+    if (!error && pixels_filename != NULL)
+        error = write_file(pixels_filename, pixels, params.width * params.height * sizeof(uint16_t));
+
+    if (error)
+        fprintf(stderr, "ipegen: cannot write output: %s\n", strerror(error));
+
+    free(stream);
+    free(pixels);
+    return error;
+}
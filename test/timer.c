@@ -2,9 +2,9 @@
 #include "timer.h"
 
 struct _Timer {
-    struct timeval  start;
+    struct timespec start;
     long            seconds;
-    long            useconds;
+    long            nseconds;
 };
 
 
@@ -12,7 +12,7 @@ Timer *
 timer_new (void)
 {
     Timer *t = (Timer *) malloc (sizeof (Timer));
-    t->seconds = t->useconds = 0L;
+    t->seconds = t->nseconds = 0L;
     return t;
 }
 
@@ -25,21 +25,21 @@ timer_destroy (Timer *t)
 void
 timer_start (Timer *t)
 {
-    gettimeofday(&t->start, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t->start);
 }
 
 void
 timer_stop (Timer *t)
 {
-    struct timeval end;
+    struct timespec end;
 
-    gettimeofday(&end, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
     t->seconds += end.tv_sec - t->start.tv_sec;
-    t->useconds += end.tv_usec - t->start.tv_usec;
+    t->nseconds += end.tv_nsec - t->start.tv_nsec;
 }
 
 double
 timer_get_seconds (Timer *t)
 {
-    return t->seconds + t->useconds / 1000.0 / 1000.0;
+    return t->seconds + t->nseconds / 1000.0 / 1000.0 / 1000.0;
 }
@@ -0,0 +1,341 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "timer.h"
+#include "writer.h"
+
+#define NUM_BUFFERS     4
+#define ALIGNMENT       4096
+
+/*
+ * Frames are copied into a ring of buffers and written by a separate thread,
+ * so that decoding the next frame overlaps writing the previous ones. With
+ * O_DIRECT only whole blocks can be written, the rest of a frame is moved to
+ * the front of the next buffer.
+ *
+ * If the output is a pipe, buffers are handed to it with vmsplice instead of
+ * being copied. The pipe then references the pages of a buffer until they are
+ * read, so a buffer may only be refilled once at least the pipe size has been
+ * written after it. Only buffers at least as large as the pipe are spliced,
+ * which means at most one buffer is ever waiting to be released.
+ */
+struct _Writer {
+    int                 fd;
+    int                 owns_fd;
+    int                 direct;
+    size_t              pipe_size;  /* Non-zero if buffers are spliced */
+    int                 pending;    /* Spliced buffer still in use or -1 */
+    size_t              pending_after;  /* Bytes written after it */
+    pthread_t           thread;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    char               *buffers[NUM_BUFFERS];
+    size_t              buffer_size;
+    size_t              lengths[NUM_BUFFERS];
+    unsigned            head;       /* Next buffer to write */
+    unsigned            count;      /* Number of buffers not yet reusable */
+    unsigned            next;       /* Buffer that is filled next */
+    int                 quit;
+    int                 error;
+    char                tail[ALIGNMENT];
+    size_t              tail_length;
+    Timer              *stall;
+};
+
+static int
+write_all (int fd, const char *data, size_t length)
+{
+    while (length > 0) {
+        ssize_t n = write (fd, data, length);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return errno;
+        }
+
+        data += n;
+        length -= n;
+    }
+
+    return 0;
+}
+
+static int
+splice_all (int fd, const char *data, size_t length)
+{
+    struct iovec iov = { .iov_base = (void *) data, .iov_len = length };
+
+    while (iov.iov_len > 0) {
+        ssize_t n = vmsplice (fd, &iov, 1, 0);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return errno;
+        }
+
+        iov.iov_base = (char *) iov.iov_base + n;
+        iov.iov_len -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * Number of buffers that have been submitted but not written yet.
+ */
+static unsigned
+num_queued (Writer *w)
+{
+    return w->count - (w->pending >= 0 ? 1 : 0);
+}
+
+static void *
+write_buffers (void *data)
+{
+    Writer *w = (Writer *) data;
+
+    pthread_mutex_lock (&w->lock);
+
+    while (1) {
+        const char *buffer;
+        size_t length;
+        int spliced;
+        int error = 0;
+
+        while (num_queued (w) == 0 && !w->quit)
+            pthread_cond_wait (&w->cond, &w->lock);
+
+        if (num_queued (w) == 0)
+            break;
+
+        buffer = w->buffers[w->head];
+        length = w->lengths[w->head];
+        spliced = w->pipe_size > 0 && length >= w->pipe_size;
+        pthread_mutex_unlock (&w->lock);
+
+        if (!w->error) {
+            if (spliced)
+                error = splice_all (w->fd, buffer, length);
+            else
+                error = write_all (w->fd, buffer, length);
+        }
+
+        pthread_mutex_lock (&w->lock);
+
+        if (error)
+            w->error = error;
+
+        if (w->pending >= 0) {
+            w->pending_after += length;
+
+            if (w->pending_after >= w->pipe_size) {
+                w->pending = -1;
+                w->count--;
+            }
+        }
+
+        if (spliced && !error) {
+            w->pending = w->head;
+            w->pending_after = 0;
+        }
+        else
+            w->count--;
+
+        w->head = (w->head + 1) % NUM_BUFFERS;
+        pthread_cond_broadcast (&w->cond);
+    }
+
+    pthread_mutex_unlock (&w->lock);
+    return NULL;
+}
+
+static Writer *
+writer_create (int fd, int owns_fd, int direct, size_t max_frame_size)
+{
+    const size_t buffer_size = (max_frame_size + 2 * ALIGNMENT - 1) & ~((size_t) ALIGNMENT - 1);
+    Writer *w = (Writer *) calloc (1, sizeof (Writer));
+    struct stat st;
+
+    if (w == NULL)
+        return NULL;
+
+    w->fd = fd;
+    w->owns_fd = owns_fd;
+    w->direct = direct;
+    w->pending = -1;
+
+    if (!direct && fstat (fd, &st) == 0 && S_ISFIFO (st.st_mode)) {
+        const int pipe_size = fcntl (fd, F_GETPIPE_SZ);
+
+        if (pipe_size > 0)
+            w->pipe_size = pipe_size;
+    }
+
+    /*
+     * Buffers are mapped rather than allocated, so that their pages are never
+     * reused by malloc while a pipe might still reference them.
+     */
+    for (int i = 0; i < NUM_BUFFERS; i++) {
+        w->buffers[i] = mmap (NULL, buffer_size, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (w->buffers[i] == MAP_FAILED) {
+            while (i-- > 0)
+                munmap (w->buffers[i], buffer_size);
+
+            free (w);
+            return NULL;
+        }
+    }
+
+    w->buffer_size = buffer_size;
+
+    w->stall = timer_new ();
+    pthread_mutex_init (&w->lock, NULL);
+    pthread_cond_init (&w->cond, NULL);
+    pthread_create (&w->thread, NULL, write_buffers, w);
+    return w;
+}
+
+/*
+ * Create a writer for frames of at most max_frame_size bytes that are saved in
+ * filename.
+ */
+Writer *
+writer_new (const char *filename, size_t max_frame_size, int direct)
+{
+    Writer *w;
+    int fd = -1;
+
+    if (direct)
+        fd = open (filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+
+    /* Not every file system supports O_DIRECT */
+    direct = fd >= 0;
+
+    if (fd < 0)
+        fd = open (filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0)
+        return NULL;
+
+    w = writer_create (fd, 1, direct, max_frame_size);
+
+    if (w == NULL)
+        close (fd);
+
+    return w;
+}
+
+/*
+ * Create a writer for an already open file descriptor, which is left open by
+ * writer_free.
+ */
+Writer *
+writer_new_for_fd (int fd, size_t max_frame_size)
+{
+    return writer_create (fd, 0, 0, max_frame_size);
+}
+
+/*
+ * Write all remaining frames and close the file. Returns the first error that
+ * occurred while writing.
+ */
+int
+writer_free (Writer *w)
+{
+    int error;
+
+    pthread_mutex_lock (&w->lock);
+    w->quit = 1;
+    pthread_cond_broadcast (&w->cond);
+    pthread_mutex_unlock (&w->lock);
+    pthread_join (w->thread, NULL);
+
+    error = w->error;
+
+    if (!error && w->tail_length > 0) {
+        fcntl (w->fd, F_SETFL, fcntl (w->fd, F_GETFL) & ~O_DIRECT);
+        error = write_all (w->fd, w->tail, w->tail_length);
+    }
+
+    if (w->owns_fd && close (w->fd) && !error)
+        error = errno;
+
+    for (int i = 0; i < NUM_BUFFERS; i++)
+        munmap (w->buffers[i], w->buffer_size);
+
+    pthread_cond_destroy (&w->cond);
+    pthread_mutex_destroy (&w->lock);
+    timer_destroy (w->stall);
+    free (w);
+    return error;
+}
+
+/*
+ * Get the location for the next frame, which might have to wait until the
+ * writer thread is done with a buffer.
+ */
+void *
+writer_get_buffer (Writer *w)
+{
+    char *buffer = w->buffers[w->next];
+
+    timer_start (w->stall);
+    pthread_mutex_lock (&w->lock);
+
+    while (w->count == NUM_BUFFERS)
+        pthread_cond_wait (&w->cond, &w->lock);
+
+    pthread_mutex_unlock (&w->lock);
+    timer_stop (w->stall);
+
+    memcpy (buffer, w->tail, w->tail_length);
+    return buffer + w->tail_length;
+}
+
+/*
+ * Queue num_bytes of the buffer returned by writer_get_buffer for writing.
+ */
+void
+writer_submit (Writer *w, size_t num_bytes)
+{
+    const unsigned slot = w->next;
+    size_t length = w->tail_length + num_bytes;
+
+    if (w->direct) {
+        const size_t aligned = length & ~((size_t) ALIGNMENT - 1);
+
+        w->tail_length = length - aligned;
+        memcpy (w->tail, w->buffers[slot] + aligned, w->tail_length);
+        length = aligned;
+    }
+
+    w->next = (slot + 1) % NUM_BUFFERS;
+
+    pthread_mutex_lock (&w->lock);
+    w->lengths[slot] = length;
+    w->count++;
+    pthread_cond_broadcast (&w->cond);
+    pthread_mutex_unlock (&w->lock);
+}
+
+/*
+ * Time spent waiting for a free buffer.
+ */
+double
+writer_get_stall_seconds (Writer *w)
+{
+    return timer_get_seconds (w->stall);
+}
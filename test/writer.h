@@ -0,0 +1,19 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stddef.h>
+
+typedef struct _Writer Writer;
+
+Writer *writer_new                  (const char *filename,
+                                     size_t      max_frame_size,
+                                     int         direct);
+Writer *writer_new_for_fd           (int         fd,
+                                     size_t      max_frame_size);
+int     writer_free                 (Writer     *w);
+void   *writer_get_buffer           (Writer     *w);
+void    writer_submit               (Writer     *w,
+                                     size_t      num_bytes);
+double  writer_get_stall_seconds    (Writer     *w);
+
+#endif